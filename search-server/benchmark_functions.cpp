@@ -0,0 +1,942 @@
+#include "benchmark_functions.h"
+#include "concurrent_map.h"
+#include "concurrent_search_server.h"
+#include "corpus_file.h"
+#include "posting_codec.h"
+#include "posting_list.h"
+#include "process_queries.h"
+#include "search_server.h"
+#include "sharded_search_server.h"
+#include "string_processing.h"
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tbb/global_control.h>
+
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Function>
+double MeasureSeconds(Function function) {
+    const Clock::time_point start = Clock::now();
+    function();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The best of a few runs, as the others are mostly noise
+template <typename Function>
+double MeasureBestSeconds(size_t run_count, Function function) {
+    double best_seconds = MeasureSeconds(function);
+    for (size_t i = 1; i < run_count; ++i) {
+        best_seconds = std::min(best_seconds, MeasureSeconds(function));
+    }
+    return best_seconds;
+}
+
+// Words of random letters; the first ones are the most frequent
+std::vector<std::string> GenerateDictionary(std::mt19937& generator, size_t word_count) {
+    std::uniform_int_distribution<int> length(3, 10);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::vector<std::string> words;
+    words.reserve(word_count);
+    for (size_t i = 0; i < word_count; ++i) {
+        std::string word(length(generator), ' ');
+        for (char& c : word) {
+            c = static_cast<char>(letter(generator));
+        }
+        words.push_back(std::move(word));
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    std::shuffle(words.begin(), words.end(), generator);
+    return words;
+}
+
+// Skewed like real text: the first percent of the dictionary takes about
+// a third of the picks
+const std::string& PickWord(std::mt19937& generator, const std::vector<std::string>& dictionary) {
+    const double x = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+    const size_t index = static_cast<size_t>(std::pow(x, 4.0) * static_cast<double>(dictionary.size()));
+    return dictionary[std::min(index, dictionary.size() - 1)];
+}
+
+std::string GenerateText(std::mt19937& generator, const std::vector<std::string>& dictionary, size_t word_count) {
+    std::string text;
+    for (size_t i = 0; i < word_count; ++i) {
+        if (i > 0) {
+            text.push_back(' ');
+        }
+        text += PickWord(generator, dictionary);
+    }
+    return text;
+}
+
+std::vector<std::string> GenerateTexts(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    size_t text_count, size_t word_count) {
+    std::vector<std::string> texts;
+    texts.reserve(text_count);
+    for (size_t i = 0; i < text_count; ++i) {
+        texts.push_back(GenerateText(generator, dictionary, word_count));
+    }
+    return texts;
+}
+
+// Every query gets a minus word with the given probability
+std::vector<std::string> GenerateQueries(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    size_t query_count, size_t word_count, double minus_word_probability = 0.0) {
+    std::bernoulli_distribution has_minus_word(minus_word_probability);
+    std::vector<std::string> queries;
+    queries.reserve(query_count);
+    for (size_t i = 0; i < query_count; ++i) {
+        std::string query = GenerateText(generator, dictionary, word_count);
+        if (has_minus_word(generator)) {
+            query += " -"s + PickWord(generator, dictionary);
+        }
+        queries.push_back(std::move(query));
+    }
+    return queries;
+}
+
+// A log of query_count queries where popular ones repeat: they are picked
+// with a skew from distinct_count distinct queries
+std::vector<std::string> GenerateQueryLog(std::mt19937& generator, const std::vector<std::string>& dictionary,
+    size_t query_count, size_t distinct_count) {
+    const std::vector<std::string> distinct_queries = GenerateQueries(generator, dictionary, distinct_count, 3, 0.2);
+    std::vector<std::string> queries;
+    queries.reserve(query_count);
+    for (size_t i = 0; i < query_count; ++i) {
+        queries.push_back(i < distinct_count ? distinct_queries[i] : PickWord(generator, distinct_queries));
+    }
+    std::shuffle(queries.begin(), queries.end(), generator);
+    return queries;
+}
+
+// Calls function(thread_count) with the parallel algorithms limited to
+// that many threads
+template <typename Function>
+void ForEachThreadCount(Function function) {
+    for (size_t thread_count : { 1, 2, 4, 8, 16, 32 }) {
+        tbb::global_control control(tbb::global_control::max_allowed_parallelism, thread_count);
+        function(thread_count);
+    }
+}
+
+// Milliseconds each call of function(query) takes, sorted
+template <typename Function>
+std::vector<double> MeasureLatencies(const std::vector<std::string>& queries, Function function) {
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    for (const std::string& query : queries) {
+        latencies.push_back(MeasureSeconds([&] { function(query); }) * 1e3);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+// Latencies are sorted and not empty
+double GetPercentile(const std::vector<double>& latencies, double percent) {
+    return latencies[std::min(latencies.size() - 1, static_cast<size_t>(percent / 100.0 * latencies.size()))];
+}
+
+std::vector<int> GenerateRatings(std::mt19937& generator) {
+    std::uniform_int_distribution<int> rating(-10, 10);
+    return { rating(generator), rating(generator), rating(generator) };
+}
+
+// Runs reader_count threads calling find(query) in a loop while this thread
+// calls write(i) for up to max_write_count documents, for about two seconds,
+// and prints the rates of both. Readers stop on time by themselves, as a
+// writer may wait for a lock as long as they keep reading
+template <typename Find, typename Write>
+void MeasureReadWrite(const std::string& name, size_t reader_count, const std::vector<std::string>& queries,
+    size_t max_write_count, Find find, Write write) {
+    const std::chrono::seconds duration(2);
+    std::atomic<bool> is_writing{ true };
+    std::atomic<size_t> query_count{ 0 };
+    std::vector<std::thread> readers;
+    const Clock::time_point start = Clock::now();
+    for (size_t reader = 0; reader < reader_count; ++reader) {
+        readers.emplace_back([&, reader] {
+            size_t reader_query_count = 0;
+            for (size_t i = reader; is_writing && Clock::now() - start < duration; i += reader_count) {
+                find(queries[i % queries.size()]);
+                ++reader_query_count;
+            }
+            query_count += reader_query_count;
+            });
+    }
+    size_t write_count = 0;
+    while (write_count < max_write_count && Clock::now() - start < duration) {
+        write(write_count++);
+    }
+    is_writing = false;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << name << ", "s << reader_count << " readers: "s << query_count / seconds << " queries/s, "s
+        << write_count / seconds << " documents/s"s << std::endl;
+}
+
+// The index the server had before the flat posting lists: a std::map from a
+// word to a std::map of its documents, scored through another std::map
+class NestedMapIndex {
+public:
+    void AddDocument(int document_id, std::string_view document) {
+        const std::vector<std::string_view> words = SplitIntoWords(document);
+        const double inverse_word_count = 1.0 / static_cast<double>(words.size());
+        for (std::string_view word : words) {
+            word_to_document_freqs_[std::string(word)][document_id] += inverse_word_count;
+        }
+        ++document_count_;
+    }
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const {
+        std::map<int, double> document_to_relevance;
+        for (std::string_view word : SplitIntoWords(raw_query)) {
+            const bool is_minus = word[0] == '-';
+            const auto word_documents = word_to_document_freqs_.find(std::string(is_minus ? word.substr(1) : word));
+            if (word_documents == word_to_document_freqs_.end()) {
+                continue;
+            }
+            if (is_minus) {
+                for (const auto& [document_id, term_freq] : word_documents->second) {
+                    document_to_relevance.erase(document_id);
+                }
+                continue;
+            }
+            const double inverse_document_freq = std::log(static_cast<double>(document_count_)
+                / static_cast<double>(word_documents->second.size()));
+            for (const auto& [document_id, term_freq] : word_documents->second) {
+                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+            }
+        }
+        std::vector<Document> matched_documents;
+        for (const auto& [document_id, relevance] : document_to_relevance) {
+            matched_documents.push_back({ document_id, relevance, 0 });
+        }
+        const size_t result_count = std::min(matched_documents.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+        std::partial_sort(matched_documents.begin(), matched_documents.begin() + result_count, matched_documents.end(),
+            [](const Document& lhs, const Document& rhs) { return lhs.relevance > rhs.relevance; });
+        matched_documents.resize(result_count);
+        return matched_documents;
+    }
+
+private:
+    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
+    size_t document_count_ = 0;
+};
+
+// The ConcurrentMap the server had before the open-addressing shards: a
+// std::mutex and a std::map in every bucket, picked by key % bucket count.
+// Reads go through operator[] too, as it has nothing else
+template <typename Key, typename Value>
+class MutexBucketMap {
+    struct Bucket {
+        std::mutex mutex;
+        std::map<Key, Value> entries;
+    };
+
+public:
+    struct Access {
+        std::lock_guard<std::mutex> guard;
+        Value& ref_to_value;
+
+        Access(const Key& key, Bucket& bucket)
+            : guard(bucket.mutex)
+            , ref_to_value(bucket.entries[key]) {
+        }
+    };
+
+    explicit MutexBucketMap(size_t bucket_count)
+        : buckets_(bucket_count) {
+    }
+
+    Access operator[](const Key& key) {
+        return { key, buckets_[static_cast<uint64_t>(key) % buckets_.size()] };
+    }
+
+    std::map<Key, Value> BuildOrdinaryMap() {
+        std::map<Key, Value> result;
+        for (auto& [mutex, entries] : buckets_) {
+            std::lock_guard guard(mutex);
+            result.insert(entries.begin(), entries.end());
+        }
+        return result;
+    }
+
+private:
+    std::vector<Bucket> buckets_;
+};
+
+// Seconds it takes thread_count threads to call operation(generator)
+// operation_count times in total, each thread with its own generator
+template <typename Operation>
+double MeasureThreads(size_t thread_count, size_t operation_count, Operation operation) {
+    return MeasureSeconds([&] {
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < thread_count; ++thread) {
+            threads.emplace_back([&, thread] {
+                std::mt19937 generator(static_cast<unsigned>(thread));
+                for (size_t i = thread; i < operation_count; i += thread_count) {
+                    operation(generator);
+                }
+                });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        });
+}
+
+const std::vector<std::pair<std::string, std::function<void()>>>& GetBenchmarks() {
+    static const std::vector<std::pair<std::string, std::function<void()>>> benchmarks = {
+        { "posting_lists"s, [] { BenchmarkPostingLists(); } },
+        { "parallel_search"s, [] { BenchmarkParallelSearch(); } },
+        { "parallel_indexing"s, [] { BenchmarkParallelIndexing(); } },
+        { "snapshot_startup"s, [] { BenchmarkSnapshotStartup(); } },
+        { "concurrent_read_write"s, [] { BenchmarkConcurrentReadWrite(); } },
+        { "posting_codec"s, [] { BenchmarkPostingCodec(); } },
+        { "sharded_search"s, [] { BenchmarkShardedSearch(); } },
+        { "query_batches"s, [] { BenchmarkQueryBatches(); } },
+        { "tokenizer"s, [] { BenchmarkTokenizer(); } },
+        { "corpus_ingestion"s, [] { BenchmarkCorpusIngestion(); } },
+        { "concurrent_map"s, [] { BenchmarkConcurrentMap(); } },
+    };
+    return benchmarks;
+}
+
+} // namespace
+
+bool RunBenchmark(const std::string& name) {
+    bool found = false;
+    for (const auto& [benchmark_name, benchmark] : GetBenchmarks()) {
+        if (name == "all"s || name == benchmark_name) {
+            std::cout << "# "s << benchmark_name << std::endl;
+            benchmark();
+            found = true;
+        }
+    }
+    return found;
+}
+
+void BenchmarkPostingLists(size_t document_count) {
+    const size_t query_count = 100;
+    std::mt19937 generator(1);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary, document_count, 10);
+    const std::vector<std::string> queries = GenerateQueries(generator, dictionary, query_count, 3, 0.5);
+
+    // The nested maps go first and are freed before the server is built
+    {
+        NestedMapIndex index;
+        const double add_seconds = MeasureSeconds([&] {
+            for (size_t i = 0; i < texts.size(); ++i) {
+                index.AddDocument(static_cast<int>(i), texts[i]);
+            }
+            });
+        size_t result_count = 0;
+        const double query_seconds = MeasureSeconds([&] {
+            for (const std::string& query : queries) {
+                result_count += index.FindTopDocuments(query).size();
+            }
+            });
+        std::cout << "nested maps: add "s << add_seconds << " s, "s
+            << query_seconds * 1e3 / query_count << " ms/query, "s << result_count << " results"s << std::endl;
+    }
+
+    SearchServer search_server(""s);
+    const double add_seconds = MeasureSeconds([&] {
+        for (size_t i = 0; i < texts.size(); ++i) {
+            search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, GenerateRatings(generator));
+        }
+        });
+    size_t result_count = 0;
+    const double query_seconds = MeasureSeconds([&] {
+        for (const std::string& query : queries) {
+            result_count += search_server.FindTopDocuments(query).size();
+        }
+        });
+    std::cout << "posting lists: add "s << add_seconds << " s, "s
+        << query_seconds * 1e3 / query_count << " ms/query, "s << result_count << " results"s << std::endl;
+}
+
+void BenchmarkParallelSearch(size_t document_count) {
+    const size_t query_count = 200;
+    std::mt19937 generator(3);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 20'000);
+    const std::vector<std::string> topics = GenerateDictionary(generator, 50);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < document_count; ++i) {
+        std::string text = GenerateText(generator, dictionary, 10);
+        // The last fifth of the ids holds almost all the postings of the topics
+        if (i * 5 >= document_count * 4) {
+            text += " "s + GenerateText(generator, topics, 3);
+        }
+        search_server.AddDocument(static_cast<int>(i), text, DocumentStatus::ACTUAL, GenerateRatings(generator));
+    }
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < query_count; ++i) {
+        queries.push_back(GenerateText(generator, topics, 2) + " "s + GenerateText(generator, dictionary, 1));
+    }
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    double single_thread_seconds = 0.0;
+    ForEachThreadCount([&](size_t thread_count) {
+        size_t result_count = 0;
+        const double seconds = MeasureBestSeconds(3, [&] {
+            result_count = 0;
+            for (const std::string& query : queries) {
+                result_count += search_server.FindTopDocuments(std::execution::par, query).size();
+            }
+            });
+        if (thread_count == 1) {
+            single_thread_seconds = seconds;
+        }
+        std::cout << thread_count << " threads: "s << query_count / seconds << " queries/s, speedup "s
+            << single_thread_seconds / seconds << ", "s << result_count << " results"s << std::endl;
+        });
+}
+
+void BenchmarkParallelIndexing(size_t document_count) {
+    const size_t batch_size = 10'000;
+    std::mt19937 generator(7);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary, document_count, 20);
+    std::vector<std::vector<NewDocument>> batches;
+    for (size_t i = 0; i < document_count; ++i) {
+        if (i % batch_size == 0) {
+            batches.emplace_back();
+        }
+        batches.back().push_back({ static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, GenerateRatings(generator) });
+    }
+
+    {
+        SearchServer search_server(""s);
+        const double seconds = MeasureSeconds([&] {
+            for (const std::vector<NewDocument>& batch : batches) {
+                for (const NewDocument& document : batch) {
+                    search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+                }
+            }
+            });
+        std::cout << "AddDocument: "s << document_count / seconds << " documents/s"s << std::endl;
+    }
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    double single_thread_seconds = 0.0;
+    ForEachThreadCount([&](size_t thread_count) {
+        SearchServer search_server(""s);
+        const double seconds = MeasureSeconds([&] {
+            for (const std::vector<NewDocument>& batch : batches) {
+                search_server.AddDocuments(std::execution::par, batch);
+            }
+            });
+        if (thread_count == 1) {
+            single_thread_seconds = seconds;
+        }
+        std::cout << thread_count << " threads: "s << document_count / seconds << " documents/s, speedup "s
+            << single_thread_seconds / seconds << std::endl;
+        });
+}
+
+void BenchmarkSnapshotStartup(size_t document_count) {
+    std::mt19937 generator(8);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary, document_count, 20);
+    const std::vector<std::string> queries = GenerateQueries(generator, dictionary, 100, 3);
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_benchmark.snapshot").string();
+    const auto run_queries = [&queries](const SearchServer& search_server) {
+        size_t result_count = 0;
+        for (const std::string& query : queries) {
+            result_count += search_server.FindTopDocuments(query).size();
+        }
+        return result_count;
+    };
+
+    {
+        SearchServer search_server(""s);
+        const double add_seconds = MeasureSeconds([&] {
+            for (size_t i = 0; i < texts.size(); ++i) {
+                search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            }
+            });
+        size_t result_count = 0;
+        const double query_seconds = MeasureSeconds([&] { result_count = run_queries(search_server); });
+        std::cout << "from text: index "s << add_seconds << " s, first queries "s << query_seconds << " s, "s
+            << result_count << " results"s << std::endl;
+        const double save_seconds = MeasureSeconds([&] { search_server.SaveSnapshot(path); });
+        std::cout << "snapshot: "s << std::filesystem::file_size(path) / (1 << 20) << " MiB, saved in "s
+            << save_seconds << " s"s << std::endl;
+    }
+
+    {
+        // The server cannot be moved out of a measured lambda, so the load is timed here
+        const Clock::time_point start = Clock::now();
+        const SearchServer search_server = SearchServer::LoadSnapshot(path);
+        const double load_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        size_t result_count = 0;
+        const double query_seconds = MeasureSeconds([&] { result_count = run_queries(search_server); });
+        std::cout << "from snapshot: load "s << load_seconds << " s, first queries "s << query_seconds << " s, "s
+            << result_count << " results"s << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void BenchmarkConcurrentReadWrite(size_t document_count, size_t max_written_document_count) {
+    std::mt19937 generator(10);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 20'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary,
+        document_count + max_written_document_count, 10);
+    const std::vector<std::string> queries = GenerateQueries(generator, dictionary, 1000, 3, 0.2);
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    for (size_t reader_count : { 1, 2, 4, 8 }) {
+        ConcurrentSearchServer concurrent_server(""s);
+        SearchServer locked_server(""s);
+        std::shared_mutex mutex;
+        for (size_t i = 0; i < document_count; ++i) {
+            concurrent_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+            locked_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, { 1 });
+        }
+        concurrent_server.Publish();
+
+        MeasureReadWrite("ConcurrentSearchServer"s, reader_count, queries, max_written_document_count,
+            [&](const std::string& query) { return concurrent_server.FindTopDocuments(query); },
+            [&](size_t i) {
+                const size_t id = document_count + i;
+                concurrent_server.AddDocument(static_cast<int>(id), texts[id], DocumentStatus::ACTUAL, { 1 });
+            });
+        MeasureReadWrite("SearchServer with shared_mutex"s, reader_count, queries, max_written_document_count,
+            [&](const std::string& query) {
+                std::shared_lock guard(mutex);
+                return locked_server.FindTopDocuments(query);
+            },
+            [&](size_t i) {
+                const size_t id = document_count + i;
+                std::lock_guard guard(mutex);
+                locked_server.AddDocument(static_cast<int>(id), texts[id], DocumentStatus::ACTUAL, { 1 });
+            });
+    }
+}
+
+void BenchmarkPostingCodec(size_t document_count) {
+    const size_t query_count = 2000;
+    std::mt19937 generator(12);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary, document_count, 8);
+    const std::vector<std::string> queries = GenerateQueries(generator, dictionary, query_count, 3);
+
+    // The postings of every word with the term frequencies the server computes
+    std::unordered_map<std::string_view, size_t> word_indexes;
+    std::vector<std::vector<int>> word_ids;
+    std::vector<std::vector<float>> word_freqs;
+    std::map<std::string_view, int> document_word_counts;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const std::vector<std::string_view> words = SplitIntoWords(texts[i]);
+        document_word_counts.clear();
+        for (std::string_view word : words) {
+            ++document_word_counts[word];
+        }
+        for (const auto& [word, count] : document_word_counts) {
+            const auto [position, inserted] = word_indexes.emplace(word, word_ids.size());
+            if (inserted) {
+                word_ids.emplace_back();
+                word_freqs.emplace_back();
+            }
+            word_ids[position->second].push_back(static_cast<int>(i));
+            word_freqs[position->second].push_back(static_cast<float>(count / static_cast<double>(words.size())));
+        }
+    }
+    std::vector<float> freq_table;
+    for (const std::vector<float>& freqs : word_freqs) {
+        freq_table.insert(freq_table.end(), freqs.begin(), freqs.end());
+    }
+    std::sort(freq_table.begin(), freq_table.end());
+    freq_table.erase(std::unique(freq_table.begin(), freq_table.end()), freq_table.end());
+
+    // Bytes of a bit-packed block of values: 4 lanes of 32-bit words
+    const auto get_packed_size = [](uint8_t bit_width) {
+        return (POSTING_BLOCK_SIZE * bit_width + 127) / 128 * 16;
+    };
+    std::vector<PackedBlock> blocks;
+    std::vector<uint8_t> data;
+    std::vector<std::pair<size_t, size_t>> list_offsets;
+    size_t posting_count = 0;
+    size_t tail_posting_count = 0;
+    size_t gap_bytes = 0;
+    size_t code_bytes = 0;
+    size_t tail_bytes = 0;
+    std::vector<uint32_t> codes;
+    for (size_t word = 0; word < word_ids.size(); ++word) {
+        codes.clear();
+        for (float freq : word_freqs[word]) {
+            codes.push_back(static_cast<uint32_t>(
+                std::lower_bound(freq_table.begin(), freq_table.end(), freq) - freq_table.begin()));
+        }
+        list_offsets.emplace_back(blocks.size(), data.size());
+        PackPostings(word_ids[word], codes, freq_table, blocks, data);
+        size_t block_bytes = 0;
+        for (size_t block = list_offsets.back().first; block < blocks.size(); ++block) {
+            gap_bytes += get_packed_size(blocks[block].gap_bit_width);
+            code_bytes += get_packed_size(blocks[block].code_bit_width);
+            block_bytes += get_packed_size(blocks[block].gap_bit_width) + get_packed_size(blocks[block].code_bit_width);
+        }
+        tail_bytes += data.size() - list_offsets.back().second - block_bytes;
+        posting_count += word_ids[word].size();
+        tail_posting_count += word_ids[word].size() % POSTING_BLOCK_SIZE;
+    }
+    std::vector<PackedPostings> packed_lists;
+    std::vector<PostingList> flat_lists(word_ids.size());
+    for (size_t word = 0; word < word_ids.size(); ++word) {
+        packed_lists.push_back({ blocks.data() + list_offsets[word].first, data.data() + list_offsets[word].second,
+            freq_table.data(), word_ids[word].size(), 0.0f });
+        for (size_t i = 0; i < word_ids[word].size(); ++i) {
+            flat_lists[word].Add(word_ids[word][i], word_freqs[word][i]);
+        }
+    }
+
+    // The flat layout without the slack of growing vectors: an id and a
+    // frequency per posting and a maximal frequency per block
+    const size_t flat_bytes = posting_count * (sizeof(int) + sizeof(float))
+        + (posting_count / POSTING_BLOCK_SIZE + word_ids.size()) * sizeof(float);
+    // A std::map node per posting, counted like SearchServer::GetMemoryUsage
+    const size_t nested_map_bytes = posting_count * (4 * sizeof(void*) + sizeof(std::pair<const int, double>));
+    const size_t header_bytes = blocks.size() * sizeof(PackedBlock);
+    const size_t packed_bytes = header_bytes + data.size() + freq_table.size() * sizeof(float);
+    const auto per_posting = [posting_count](size_t bytes) {
+        return static_cast<double>(bytes) / static_cast<double>(posting_count);
+    };
+    std::cout << "postings: "s << posting_count << " in "s << word_ids.size() << " lists, "s
+        << tail_posting_count << " of them in tails, "s << freq_table.size() << " distinct frequencies"s << std::endl;
+    std::cout << "nested maps: "s << per_posting(nested_map_bytes) << " B/posting"s << std::endl;
+    std::cout << "flat: "s << per_posting(flat_bytes) << " B/posting"s << std::endl;
+    std::cout << "packed: "s << per_posting(packed_bytes) << " B/posting, "s
+        << static_cast<double>(flat_bytes) / static_cast<double>(packed_bytes) << "x smaller than flat, "s
+        << static_cast<double>(nested_map_bytes) / static_cast<double>(packed_bytes) << "x than nested maps"s << std::endl;
+    std::cout << "  block headers "s << per_posting(header_bytes) << ", gaps "s << per_posting(gap_bytes)
+        << ", frequency codes "s << per_posting(code_bytes) << ", tails "s << per_posting(tail_bytes)
+        << " B/posting"s << std::endl;
+
+    // Every posting read through a cursor, and the ids alone through UnpackBlockIds
+    const auto measure_decode = [&](const std::string& name, auto decode_list) {
+        double checksum = 0.0;
+        const double seconds = MeasureBestSeconds(3, [&] {
+            checksum = 0.0;
+            for (size_t word = 0; word < word_ids.size(); ++word) {
+                checksum += decode_list(word);
+            }
+            });
+        std::cout << name << ": "s << posting_count / seconds / 1e6 << " M postings/s, checksum "s
+            << checksum << std::endl;
+    };
+    const auto read_cursor = [](PostingList::Cursor cursor) {
+        double sum = 0.0;
+        for (; !cursor.IsEnd(); cursor.Next()) {
+            sum += cursor.GetDocumentId() + cursor.GetTermFreq();
+        }
+        return sum;
+    };
+    measure_decode("flat cursor"s, [&](size_t word) { return read_cursor(PostingList::Cursor(flat_lists[word])); });
+    measure_decode("packed cursor"s, [&](size_t word) { return read_cursor(PostingList::Cursor(packed_lists[word])); });
+    measure_decode("packed ids"s, [&](size_t word) {
+        std::array<int, POSTING_BLOCK_SIZE> ids;
+        double sum = 0.0;
+        const size_t block_count = (packed_lists[word].size + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+        for (size_t block = 0; block < block_count; ++block) {
+            const size_t size = UnpackBlockIds(packed_lists[word], block, ids.data());
+            sum += ids[size - 1];
+        }
+        return sum;
+        });
+    flat_lists.clear();
+    flat_lists.shrink_to_fit();
+
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        search_server.AddDocument(static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, GenerateRatings(generator));
+    }
+    std::cout << "server postings: "s << per_posting(search_server.GetMemoryUsage().postings) << " B/posting"s
+        << std::endl;
+    for (const auto& [name, evaluation] : { std::pair{ "exhaustive"s, QueryEvaluation::EXHAUSTIVE },
+        std::pair{ "WAND"s, QueryEvaluation::WAND } }) {
+        size_t result_count = 0;
+        const double seconds = MeasureBestSeconds(3, [&] {
+            result_count = 0;
+            for (const std::string& query : queries) {
+                result_count += search_server.FindTopDocuments(query, DocumentStatus::ACTUAL,
+                    MAX_RESULT_DOCUMENT_COUNT, evaluation).size();
+            }
+            });
+        std::cout << name << ": "s << query_count / seconds << " queries/s, "s << result_count << " results"s
+            << std::endl;
+    }
+}
+
+void BenchmarkShardedSearch(size_t document_count) {
+    const size_t query_count = 1000;
+    std::mt19937 generator(13);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::vector<std::string> texts = GenerateTexts(generator, dictionary, document_count, 10);
+    const std::vector<std::string> queries = GenerateQueries(generator, dictionary, query_count, 3, 0.2);
+    std::vector<NewDocument> documents;
+    for (size_t i = 0; i < document_count; ++i) {
+        documents.push_back({ static_cast<int>(i), texts[i], DocumentStatus::ACTUAL, GenerateRatings(generator) });
+    }
+    const auto print_latencies = [](const std::string& name, const std::vector<double>& latencies) {
+        double sum = 0.0;
+        for (double latency : latencies) {
+            sum += latency;
+        }
+        std::cout << name << ": mean "s << sum / latencies.size() << " ms, p50 "s << GetPercentile(latencies, 50.0)
+            << " ms, p99 "s << GetPercentile(latencies, 99.0) << " ms"s << std::endl;
+    };
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    {
+        SearchServer search_server(""s);
+        search_server.AddDocuments(std::execution::par, documents);
+        for (const auto& [name, evaluation] : { std::pair{ "SearchServer, exhaustive"s, QueryEvaluation::EXHAUSTIVE },
+            std::pair{ "SearchServer, WAND"s, QueryEvaluation::WAND } }) {
+            print_latencies(name, MeasureLatencies(queries, [&](const std::string& query) {
+                return search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, MAX_RESULT_DOCUMENT_COUNT,
+                    evaluation);
+                }));
+        }
+    }
+    for (size_t shard_count : { 1, 2, 4, 8, 16 }) {
+        ShardedSearchServer search_server(""s, shard_count);
+        search_server.AddDocuments(std::execution::par, documents);
+        for (const auto& [name, evaluation] : { std::pair{ "exhaustive"s, QueryEvaluation::EXHAUSTIVE },
+            std::pair{ "WAND"s, QueryEvaluation::WAND } }) {
+            print_latencies(std::to_string(shard_count) + " shards, "s + name,
+                MeasureLatencies(queries, [&](const std::string& query) {
+                    return search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, MAX_RESULT_DOCUMENT_COUNT,
+                        evaluation);
+                    }));
+        }
+    }
+}
+
+void BenchmarkQueryBatches(size_t document_count) {
+    std::mt19937 generator(14);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    SearchServer search_server(""s);
+    for (size_t i = 0; i < document_count; ++i) {
+        search_server.AddDocument(static_cast<int>(i), GenerateText(generator, dictionary, 10), DocumentStatus::ACTUAL,
+            GenerateRatings(generator));
+    }
+    const auto have_same_ids = [](const std::vector<std::vector<Document>>& lhs,
+        const std::vector<std::vector<Document>>& rhs) {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            [](const std::vector<Document>& lhs_documents, const std::vector<Document>& rhs_documents) {
+                return std::equal(lhs_documents.begin(), lhs_documents.end(), rhs_documents.begin(),
+                    rhs_documents.end(), [](const Document& lhs, const Document& rhs) { return lhs.id == rhs.id; });
+            });
+    };
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    for (const auto& [query_count, distinct_count] : { std::pair{ 4000, 1000 }, std::pair{ 4000, 4000 } }) {
+        const std::vector<std::string> queries = GenerateQueryLog(generator, dictionary, query_count, distinct_count);
+        std::vector<std::vector<Document>> results;
+        std::vector<std::vector<Document>> batched_results;
+        std::vector<std::vector<Document>> sequential_batched_results;
+        const double seconds = MeasureSeconds([&] { results = ProcessQueries(search_server, queries); });
+        const double batched_seconds = MeasureSeconds([&] {
+            batched_results = ProcessQueriesBatched(search_server, queries);
+            });
+        const double sequential_batched_seconds = MeasureSeconds([&] {
+            sequential_batched_results = search_server.FindTopDocumentsBatch(queries);
+            });
+        std::cout << query_count << " queries, "s << distinct_count << " distinct: ProcessQueries "s
+            << query_count / seconds << " queries/s, ProcessQueriesBatched "s << query_count / batched_seconds
+            << " queries/s, FindTopDocumentsBatch "s << query_count / sequential_batched_seconds << " queries/s, "s
+            << (have_same_ids(results, batched_results) && have_same_ids(results, sequential_batched_results)
+                ? "same"s : "different"s) << " results"s << std::endl;
+    }
+}
+
+void BenchmarkTokenizer(size_t text_byte_count) {
+    std::mt19937 generator(21);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    // The most frequent words, as stop words are
+    const std::vector<std::string> stop_words(dictionary.begin(), dictionary.begin() + 20);
+    std::vector<std::string> texts;
+    size_t byte_count = 0;
+    while (byte_count < text_byte_count) {
+        texts.push_back(GenerateText(generator, dictionary, 20));
+        byte_count += texts.back().size();
+    }
+
+    const auto measure = [&](const std::string& name, auto split) {
+        size_t word_count = 0;
+        const double seconds = MeasureBestSeconds(3, [&] {
+            word_count = 0;
+            for (const std::string& text : texts) {
+                word_count += split(text);
+            }
+            });
+        std::cout << name << ": "s << byte_count / seconds / (1 << 20) << " MB/s, "s << word_count << " words"s
+            << std::endl;
+    };
+    std::cout << byte_count / (1 << 20) << " MB in "s << texts.size() << " texts"s << std::endl;
+
+    // What SearchServer did before the tokenizer: split, check every word
+    // for control characters and look it up among the stop words
+    const std::set<std::string, std::less<>> stop_word_set(stop_words.begin(), stop_words.end());
+    std::vector<std::string_view> words;
+    measure("SplitIntoWords, validation, std::set"s, [&](std::string_view text) {
+        SplitIntoWords(text, words);
+        size_t word_count = 0;
+        for (std::string_view word : words) {
+            if (std::any_of(word.begin(), word.end(), [](char c) { return c >= '\0' && c < ' '; })) {
+                return size_t{ 0 };
+            }
+            word_count += stop_word_set.count(word) == 0;
+        }
+        return word_count;
+        });
+    const Tokenizer tokenizer(stop_words);
+    measure("Tokenizer"s, [&](std::string_view text) {
+        return tokenizer.SplitIntoWordsNoStop(text, words) ? 0 : words.size();
+        });
+}
+
+void BenchmarkCorpusIngestion(size_t corpus_byte_count) {
+    std::mt19937 generator(22);
+    const std::vector<std::string> dictionary = GenerateDictionary(generator, 50'000);
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_benchmark.corpus").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        size_t byte_count = 0;
+        for (int id = 0; byte_count < corpus_byte_count; ++id) {
+            const std::vector<int> ratings = GenerateRatings(generator);
+            const std::string line = std::to_string(id) + "\tACTUAL\t"s + std::to_string(ratings[0]) + " "s
+                + std::to_string(ratings[1]) + "\t"s + GenerateText(generator, dictionary, 20) + "\n"s;
+            out << line;
+            byte_count += line.size();
+        }
+    }
+    const double gigabytes = static_cast<double>(std::filesystem::file_size(path)) / (1 << 30);
+    std::cout << gigabytes * 1024 << " MB corpus"s << std::endl;
+
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << std::endl;
+    size_t document_count = 0;
+    const double read_seconds = MeasureBestSeconds(3, [&] {
+        CorpusFile corpus(path);
+        std::vector<NewDocument> documents;
+        document_count = 0;
+        while (corpus.ReadBatch(documents)) {
+            document_count += documents.size();
+        }
+        });
+    std::cout << "CorpusFile::ReadBatch: "s << gigabytes / read_seconds << " GB/s, "s << document_count
+        << " documents"s << std::endl;
+
+    const double load_seconds = MeasureSeconds([&] {
+        SearchServer search_server(""s);
+        document_count = LoadCorpus(search_server, path);
+        });
+    std::cout << "LoadCorpus: "s << gigabytes / load_seconds << " GB/s, "s << document_count / load_seconds
+        << " documents/s"s << std::endl;
+    const double parallel_load_seconds = MeasureSeconds([&] {
+        SearchServer search_server(""s);
+        document_count = LoadCorpus(std::execution::par, search_server, path);
+        });
+    std::cout << "LoadCorpus(par): "s << gigabytes / parallel_load_seconds << " GB/s, "s
+        << document_count / parallel_load_seconds << " documents/s"s << std::endl;
+    std::filesystem::remove(path);
+}
+
+void BenchmarkConcurrentMap(size_t operation_count) {
+    const size_t bucket_count = 16;
+    std::cout << "hardware threads: "s << std::thread::hardware_concurrency() << ", "s << bucket_count
+        << " buckets, "s << operation_count << " operations"s << std::endl;
+    for (int key_count : { 1'000, 1'000'000 }) {
+        for (size_t thread_count : { 1, 2, 4, 8 }) {
+            MutexBucketMap<int, int> old_map(bucket_count);
+            ConcurrentMap<int, int> new_map(bucket_count);
+            for (int key = 0; key < key_count; ++key) {
+                old_map[key].ref_to_value = key;
+                new_map[key].ref_to_value = key;
+            }
+            // Distributions are made for every call, so threads share nothing
+            const auto random_key = [key_count](std::mt19937& generator) {
+                return std::uniform_int_distribution<int>(0, key_count - 1)(generator);
+            };
+            const auto is_write = [](std::mt19937& generator) {
+                return std::bernoulli_distribution(0.1)(generator);
+            };
+
+            const double old_increment_seconds = MeasureThreads(thread_count, operation_count,
+                [&](std::mt19937& generator) {
+                    ++old_map[random_key(generator)].ref_to_value;
+                    });
+            const double new_increment_seconds = MeasureThreads(thread_count, operation_count,
+                [&](std::mt19937& generator) {
+                    ++new_map[random_key(generator)].ref_to_value;
+                    });
+            std::atomic<int64_t> sum{ 0 };
+            const double old_read_seconds = MeasureThreads(thread_count, operation_count,
+                [&](std::mt19937& generator) {
+                    const int key = random_key(generator);
+                    if (is_write(generator)) {
+                        ++old_map[key].ref_to_value;
+                    } else {
+                        sum.fetch_add(old_map[key].ref_to_value, std::memory_order_relaxed);
+                    }
+                    });
+            const double new_read_seconds = MeasureThreads(thread_count, operation_count,
+                [&](std::mt19937& generator) {
+                    const int key = random_key(generator);
+                    if (is_write(generator)) {
+                        ++new_map[key].ref_to_value;
+                    } else {
+                        new_map.Visit(key, [&sum](int value) { sum.fetch_add(value, std::memory_order_relaxed); });
+                    }
+                    });
+            std::cout << key_count << " keys, "s << thread_count << " threads: increments old "s
+                << operation_count / old_increment_seconds / 1e6 << " M/s, new "s
+                << operation_count / new_increment_seconds / 1e6 << " M/s; 90% reads old "s
+                << operation_count / old_read_seconds / 1e6 << " M/s, new "s
+                << operation_count / new_read_seconds / 1e6 << " M/s"s << std::endl;
+
+            if (thread_count == 1) {
+                size_t old_entry_count = 0;
+                const double old_pass_seconds = MeasureSeconds([&] {
+                    old_entry_count = old_map.BuildOrdinaryMap().size();
+                    });
+                size_t new_entry_count = 0;
+                const double new_pass_seconds = MeasureSeconds([&] {
+                    new_map.ForEach([&new_entry_count](int, int) { ++new_entry_count; });
+                    });
+                std::cout << key_count << " keys, one pass: old BuildOrdinaryMap "s << old_pass_seconds * 1e3
+                    << " ms over "s << old_entry_count << " entries, new ForEach "s << new_pass_seconds * 1e3
+                    << " ms over "s << new_entry_count << " entries"s << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+
+// Runs the benchmark with the given name, or every one of them for "all",
+// and prints the results to std::cout. Returns false for an unknown name
+bool RunBenchmark(const std::string& name);
+
+// Before and after of the flat posting lists: the nested std::map index the
+// server started with against the current one, on a million documents
+void BenchmarkPostingLists(size_t document_count = 1'000'000);
+
+// Queries per second of FindTopDocuments(par) with 1 to 32 threads, on a
+// corpus where the query words crowd into the newest documents
+void BenchmarkParallelSearch(size_t document_count = 200'000);
+
+// Documents per second of AddDocuments(par) with 1 to 32 threads, next to
+// adding them one by one
+void BenchmarkParallelIndexing(size_t document_count = 200'000);
+
+// Startup time: indexing the texts again against loading a snapshot of the
+// same index, each followed by the first queries
+void BenchmarkSnapshotStartup(size_t document_count = 500'000);
+
+// Queries and writes per second with 1 to 8 readers and a writer adding
+// documents to an index of document_count, for ConcurrentSearchServer and for
+// a SearchServer behind a std::shared_mutex
+void BenchmarkConcurrentReadWrite(size_t document_count = 50'000, size_t max_written_document_count = 50'000);
+
+// Bytes per posting of the packed postings of sealed segments against the
+// flat arrays, split into block headers, gaps, frequency codes and varint
+// tails, then decoding speed and queries per second of both evaluations
+void BenchmarkPostingCodec(size_t document_count = 1'000'000);
+
+// Query latency (mean, median and 99th percentile) of ShardedSearchServer
+// with 1 to 16 shards, next to a single SearchServer with the same documents
+void BenchmarkShardedSearch(size_t document_count = 500'000);
+
+// ProcessQueries against the batched FindTopDocumentsBatch, with and without
+// ProcessQueriesBatched, on query logs where popular queries repeat and on
+// ones of distinct queries
+void BenchmarkQueryBatches(size_t document_count = 200'000);
+
+// Megabytes per second of Tokenizer::SplitIntoWordsNoStop against splitting,
+// validating and looking up stop words word by word
+void BenchmarkTokenizer(size_t text_byte_count = 64 << 20);
+
+// Gigabytes per second of reading a corpus file with CorpusFile alone and of
+// loading it into a SearchServer with LoadCorpus, sequential and parallel
+void BenchmarkCorpusIngestion(size_t corpus_byte_count = 128 << 20);
+
+// Operations per second of ConcurrentMap against the std::map buckets under
+// a std::mutex it replaced, with 1 to 8 threads: increments, and 90% reads
+// with 10% increments, on a thousand and a million keys
+void BenchmarkConcurrentMap(size_t operation_count = 2'000'000);
@@ -1,67 +1,219 @@
 #pragma once
 
 #include <algorithm>
-#include <cstdlib>
-#include <future>
+#include <cstdint>
+#include <functional>
 #include <map>
-#include <numeric>
-#include <random>
-#include <string>
-#include <vector>
-#include <atomic>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#include "log_duration.h"
-
-using namespace std::string_literals;
-
-template <typename Key, typename Value>
+// Hash map split into shards, each with its own lock and open-addressing
+// table. Writers of different shards never wait for each other and readers
+// of a shard share its lock. Any key with a Hash and operator== will do
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
 class ConcurrentMap {
+    // Keeps neighbouring shards and their locks out of one cache line
+    const static size_t cache_line_size_ = 64;
+    const static size_t min_capacity_ = 8;
+    const static uint64_t occupied_bit_ = uint64_t{ 1 } << 63;
 
-    struct Bucket {
-        std::mutex bucket_mut;
-        std::map<Key, Value> bucket_map;
-        void Erase(const Key& key) {
-            bucket_map.erase(key);
-        }
+    // Linear probing over hashes and entries kept apart, so a probe reads
+    // a few hashes in a row. A hash of 0 marks an empty slot
+    struct alignas(cache_line_size_) Shard {
+        mutable std::shared_mutex mutex;
+        std::vector<uint64_t> hashes;
+        std::vector<std::optional<std::pair<Key, Value>>> entries;
+        size_t size = 0;
     };
 
 public:
-
-    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
-
+    // Holds the lock of the shard of the key while the value is used
     struct Access {
-        std::lock_guard<std::mutex> guard;
+        std::unique_lock<std::shared_mutex> guard;
         Value& ref_to_value;
-
-        Access(const Key& key, Bucket& bucket)
-            : guard(bucket.bucket_mut)
-            , ref_to_value(bucket.bucket_map[key]) {
-        }
     };
 
+    // Four shards per hardware thread
+    ConcurrentMap()
+        : ConcurrentMap(std::max(1u, std::thread::hardware_concurrency()) * 4) {
+    }
+
+    // bucket_count is the number of shards, rounded up to a power of two
     explicit ConcurrentMap(size_t bucket_count)
-        :buckets_(bucket_count) {}
+        : shards_(RoundUpToPowerOfTwo(bucket_count)) {
+    }
 
+    // Inserts a default value if the key is missing
     Access operator[](const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        return { key, bucket };
+        const uint64_t hash = GetHash(key);
+        Shard& shard = GetShard(hash);
+        std::unique_lock guard(shard.mutex);
+        size_t slot = FindSlot(shard, key, hash);
+        if (shard.hashes.empty() || shard.hashes[slot] == 0) {
+            if ((shard.size + 1) * 4 > shard.hashes.size() * 3) {
+                Rehash(shard, shard.hashes.empty() ? min_capacity_ : shard.hashes.size() * 2);
+                slot = FindSlot(shard, key, hash);
+            }
+            shard.hashes[slot] = hash;
+            shard.entries[slot].emplace(key, Value());
+            ++shard.size;
+        }
+        return { std::move(guard), shard.entries[slot]->second };
     }
 
-    void Erase(const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        bucket.Erase(key);
+    // Calls function(const Value&) under a shared lock if the key is present
+    template <typename Function>
+    bool Visit(const Key& key, Function function) const {
+        const uint64_t hash = GetHash(key);
+        const Shard& shard = GetShard(hash);
+        std::shared_lock guard(shard.mutex);
+        if (shard.size == 0) {
+            return false;
+        }
+        const size_t slot = FindSlot(shard, key, hash);
+        if (shard.hashes[slot] == 0) {
+            return false;
+        }
+        function(static_cast<const Value&>(shard.entries[slot]->second));
+        return true;
     }
 
-    std::map<Key, Value> BuildOrdinaryMap() {
-        std::map<Key, Value> result;
-        for (auto& [bucket_mut, bucket_map] : buckets_) {
-            std::lock_guard g(bucket_mut);
-            result.insert(bucket_map.begin(), bucket_map.end());
+    bool Erase(const Key& key) {
+        const uint64_t hash = GetHash(key);
+        Shard& shard = GetShard(hash);
+        std::lock_guard guard(shard.mutex);
+        if (shard.size == 0) {
+            return false;
+        }
+        size_t slot = FindSlot(shard, key, hash);
+        if (shard.hashes[slot] == 0) {
+            return false;
+        }
+        // Moves back the entries after the erased one which would not be
+        // found past the gap, instead of leaving a tombstone
+        const size_t mask = shard.hashes.size() - 1;
+        for (size_t next = (slot + 1) & mask; shard.hashes[next] != 0; next = (next + 1) & mask) {
+            const size_t home = shard.hashes[next] & mask;
+            if (((next - home) & mask) >= ((next - slot) & mask)) {
+                shard.hashes[slot] = shard.hashes[next];
+                shard.entries[slot] = std::move(shard.entries[next]);
+                slot = next;
+            }
+        }
+        shard.hashes[slot] = 0;
+        shard.entries[slot].reset();
+        --shard.size;
+        return true;
+    }
+
+    size_t GetShardCount() const {
+        return shards_.size();
+    }
+
+    // Calls function(const Key&, const Value&) for every entry, holding the
+    // shared lock of one shard at a time
+    template <typename Function>
+    void ForEach(Function function) const {
+        for (const Shard& shard : shards_) {
+            std::shared_lock guard(shard.mutex);
+            for (const auto& entry : shard.entries) {
+                if (entry) {
+                    function(static_cast<const Key&>(entry->first), static_cast<const Value&>(entry->second));
+                }
+            }
         }
+    }
+
+    // Moves every entry into function(Key&&, Value&&) and leaves the map empty
+    template <typename Function>
+    void Drain(Function function) {
+        for (Shard& shard : shards_) {
+            std::unique_lock guard(shard.mutex);
+            std::vector<std::optional<std::pair<Key, Value>>> entries = std::move(shard.entries);
+            shard.hashes = {};
+            shard.entries = {};
+            shard.size = 0;
+            guard.unlock();
+            for (auto& entry : entries) {
+                if (entry) {
+                    function(std::move(entry->first), std::move(entry->second));
+                }
+            }
+        }
+    }
+
+    // Copies everything; ForEach and Drain do without the copy
+    std::map<Key, Value> BuildOrdinaryMap() const {
+        std::map<Key, Value> result;
+        ForEach([&result](const Key& key, const Value& value) {
+            result.emplace(key, value);
+            });
         return result;
     }
 
 private:
-    std::vector<Bucket> buckets_;
-};
\ No newline at end of file
+    std::vector<Shard> shards_;
+
+    static size_t RoundUpToPowerOfTwo(size_t value) {
+        size_t power = 1;
+        while (power < value) {
+            power *= 2;
+        }
+        return power;
+    }
+
+    // std::hash of an integer is the integer itself, so the bits are mixed
+    // before the low ones pick a slot and the high ones a shard
+    static uint64_t GetHash(const Key& key) {
+        uint64_t hash = static_cast<uint64_t>(Hash{}(key));
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+        return (hash ^ (hash >> 31)) | occupied_bit_;
+    }
+
+    Shard& GetShard(uint64_t hash) {
+        return shards_[(hash >> 32) & (shards_.size() - 1)];
+    }
+
+    const Shard& GetShard(uint64_t hash) const {
+        return shards_[(hash >> 32) & (shards_.size() - 1)];
+    }
+
+    // Returns the slot of the key or the empty one where it would go, or 0
+    // if the shard has no slots yet
+    static size_t FindSlot(const Shard& shard, const Key& key, uint64_t hash) {
+        if (shard.hashes.empty()) {
+            return 0;
+        }
+        const size_t mask = shard.hashes.size() - 1;
+        size_t slot = hash & mask;
+        while (shard.hashes[slot] != 0
+            && (shard.hashes[slot] != hash || !(shard.entries[slot]->first == key))) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    static void Rehash(Shard& shard, size_t capacity) {
+        std::vector<uint64_t> hashes(capacity, 0);
+        std::vector<std::optional<std::pair<Key, Value>>> entries(capacity);
+        const size_t mask = capacity - 1;
+        for (size_t i = 0; i < shard.hashes.size(); ++i) {
+            if (shard.hashes[i] == 0) {
+                continue;
+            }
+            size_t slot = shard.hashes[i] & mask;
+            while (hashes[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            hashes[slot] = shard.hashes[i];
+            entries[slot] = std::move(shard.entries[i]);
+        }
+        shard.hashes = std::move(hashes);
+        shard.entries = std::move(entries);
+    }
+};
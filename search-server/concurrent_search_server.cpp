@@ -0,0 +1,111 @@
+#include "concurrent_search_server.h"
+
+#include <stdexcept>
+
+using namespace std::literals;
+
+std::shared_ptr<const SearchServer> ConcurrentSearchServer::GetSnapshot() const {
+    std::lock_guard guard(publish_mutex_);
+    return published_;
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return GetSnapshot()->GetDocumentCount();
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    ApplyWrite([document_id, document = std::string(document), status, ratings](SearchServer& server) {
+        server.AddDocument(document_id, document, status, ratings);
+        });
+}
+
+void ConcurrentSearchServer::AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents) {
+    // The replay happens after the caller's texts may be gone, so the batch keeps its own copies
+    auto texts = std::make_shared<std::vector<std::string>>();
+    texts->reserve(documents.size());
+    auto batch = std::make_shared<std::vector<NewDocument>>(documents);
+    for (NewDocument& document : *batch) {
+        texts->emplace_back(document.text);
+        document.text = texts->back();
+    }
+    ApplyWrite([texts, batch](SearchServer& server) {
+        server.AddDocuments(std::execution::par, *batch);
+        });
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    ApplyWrite([document_id](SearchServer& server) {
+        server.RemoveDocument(document_id);
+        });
+}
+
+void ConcurrentSearchServer::Compact() {
+    ApplyWrite([](SearchServer& server) {
+        server.Compact();
+        });
+}
+
+void ConcurrentSearchServer::Publish() {
+    std::lock_guard guard(write_mutex_);
+    PublishLocked();
+}
+
+// A write which throws leaves no trace in the log, and the same write on the
+// other generation would throw the same way
+void ConcurrentSearchServer::ApplyWrite(Write write) {
+    std::lock_guard guard(write_mutex_);
+    CatchUpStandby();
+    write(*standby_);
+    pending_writes_.push_back(std::move(write));
+    if (pending_writes_.size() >= max_pending_writes_) {
+        PublishLocked();
+    }
+}
+
+// The swapped out lease may be the last copy, and then it is released here
+void ConcurrentSearchServer::PublishLocked() {
+    if (pending_writes_.empty()) {
+        return;
+    }
+    std::shared_ptr<const SearchServer> lease = MakeLease(standby_);
+    {
+        std::lock_guard guard(publish_mutex_);
+        published_.swap(lease);
+    }
+    standby_.swap(published_server_);
+    ++retired_lease_count_;
+    missed_writes_.swap(pending_writes_);
+    pending_writes_.clear();
+    lease.reset();
+}
+
+// Waits until the last reader of the old generation drops its lease. The
+// lease release mutex orders their reads before the writes below
+void ConcurrentSearchServer::CatchUpStandby() {
+    if (missed_writes_.empty()) {
+        return;
+    }
+    {
+        std::unique_lock guard(lease_release_->mutex);
+        if (!lease_release_->condition.wait_for(guard, max_snapshot_wait_, [this] {
+            return lease_release_->released_count == retired_lease_count_;
+            })) {
+            throw std::runtime_error("A snapshot of the previous generation is still held"s);
+        }
+    }
+    for (const Write& write : missed_writes_) {
+        write(*standby_);
+    }
+    missed_writes_.clear();
+}
+
+std::shared_ptr<const SearchServer> ConcurrentSearchServer::MakeLease(std::shared_ptr<SearchServer> server) const {
+    SearchServer* const server_pointer = server.get();
+    return std::shared_ptr<const SearchServer>(server_pointer,
+        [server = std::move(server), lease_release = lease_release_](const SearchServer*) {
+            std::lock_guard guard(lease_release->mutex);
+            ++lease_release->released_count;
+            lease_release->condition.notify_all();
+        });
+}
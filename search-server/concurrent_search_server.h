@@ -0,0 +1,124 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const size_t DEFAULT_MAX_PENDING_WRITES = 1024;
+const std::chrono::milliseconds DEFAULT_MAX_SNAPSHOT_WAIT{ 10'000 };
+
+// SearchServer which can be queried while documents are added and removed.
+// It keeps two generations of the index: readers take the published one
+// under a short lock and query it without any, while writers change the
+// other one. Publish() swaps
+// them, so a reader sees all the writes made before the swap or none of them.
+// Writes made to the new generation are replayed on the old one once its
+// last reader is gone, so every write is applied twice and the index takes
+// twice the memory
+class ConcurrentSearchServer {
+public:
+    // A write waits up to max_snapshot_wait for the readers of the old
+    // generation to release it
+    template <typename StopWords>
+    explicit ConcurrentSearchServer(const StopWords& stop_words,
+        size_t max_pending_writes = DEFAULT_MAX_PENDING_WRITES,
+        std::chrono::milliseconds max_snapshot_wait = DEFAULT_MAX_SNAPSHOT_WAIT);
+
+    // The published generation; it is never changed while a reader holds it,
+    // but a generation held after the next Publish() stops the write after it
+    // until it is released. A write which waits longer than max_snapshot_wait
+    // throws std::runtime_error without being applied, so a thread must not
+    // hold a snapshot while it writes
+    std::shared_ptr<const SearchServer> GetSnapshot() const;
+
+    template <typename... Args>
+    std::vector<Document> FindTopDocuments(const Args&... args) const;
+
+    template <typename... Args>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const Args&... args) const;
+
+    template <typename... Args>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const Args&... args) const;
+
+    int GetDocumentCount() const;
+
+    // Writes are serialized and become visible to readers after Publish(),
+    // which is also called every max_pending_writes writes
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+
+    void AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents);
+
+    void RemoveDocument(int document_id);
+
+    void Compact();
+
+    void Publish();
+
+private:
+    using Write = std::function<void(SearchServer&)>;
+
+    // Counts the leases of generations which no reader holds anymore
+    struct LeaseRelease {
+        std::mutex mutex;
+        std::condition_variable condition;
+        uint64_t released_count = 0;
+    };
+
+    std::shared_ptr<LeaseRelease> lease_release_;
+    std::shared_ptr<SearchServer> published_server_;
+    std::shared_ptr<SearchServer> standby_;
+    mutable std::mutex publish_mutex_;
+    std::shared_ptr<const SearchServer> published_;     // a lease of published_server_, guarded by publish_mutex_
+    uint64_t retired_lease_count_ = 0;
+    std::mutex write_mutex_;
+    std::vector<Write> pending_writes_;                 // applied to standby_ only
+    std::vector<Write> missed_writes_;                  // applied to published_server_ only
+    size_t max_pending_writes_;
+    std::chrono::milliseconds max_snapshot_wait_;
+
+    // Readers share one lease of a generation, which counts itself released
+    // once its last copy is gone
+    std::shared_ptr<const SearchServer> MakeLease(std::shared_ptr<SearchServer> server) const;
+
+    void ApplyWrite(Write write);
+
+    void PublishLocked();
+
+    void CatchUpStandby();
+};
+
+template <typename StopWords>
+ConcurrentSearchServer::ConcurrentSearchServer(const StopWords& stop_words, size_t max_pending_writes,
+    std::chrono::milliseconds max_snapshot_wait)
+    : lease_release_(std::make_shared<LeaseRelease>())
+    , published_server_(std::make_shared<SearchServer>(stop_words))
+    , standby_(std::make_shared<SearchServer>(stop_words))
+    , published_(MakeLease(published_server_))
+    , max_pending_writes_(std::max<size_t>(1, max_pending_writes))
+    , max_snapshot_wait_(max_snapshot_wait)
+{
+}
+
+template <typename... Args>
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(const Args&... args) const {
+    return GetSnapshot()->FindTopDocuments(args...);
+}
+
+template <typename... Args>
+std::tuple<std::vector<std::string_view>, DocumentStatus> ConcurrentSearchServer::MatchDocument(
+    const Args&... args) const {
+    return GetSnapshot()->MatchDocument(args...);
+}
+
+template <typename... Args>
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> ConcurrentSearchServer::MatchDocuments(
+    const Args&... args) const {
+    return GetSnapshot()->MatchDocuments(args...);
+}
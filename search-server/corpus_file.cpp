@@ -0,0 +1,157 @@
+#include "corpus_file.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+
+// Splits off the text before the next tab
+bool ReadField(std::string_view& line, std::string_view& field) {
+    const size_t tab = line.find('\t');
+    if (tab == line.npos) {
+        return false;
+    }
+    field = line.substr(0, tab);
+    line.remove_prefix(tab + 1);
+    return true;
+}
+
+bool ParseInt(std::string_view text, int& value) {
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() && end == text.data() + text.size();
+}
+
+bool ParseStatus(std::string_view text, DocumentStatus& status) {
+    const std::string_view names[] = { "ACTUAL"sv, "IRRELEVANT"sv, "BANNED"sv, "REMOVED"sv };
+    const auto name = std::find(std::begin(names), std::end(names), text);
+    if (name == std::end(names)) {
+        return false;
+    }
+    status = static_cast<DocumentStatus>(name - std::begin(names));
+    return true;
+}
+
+bool ParseRatings(std::string_view text, std::vector<int>& ratings) {
+    const char* position = text.data();
+    const char* end = text.data() + text.size();
+    while (true) {
+        while (position != end && *position == ' ') {
+            ++position;
+        }
+        if (position == end) {
+            return true;
+        }
+        int rating = 0;
+        const auto [next, error] = std::from_chars(position, end, rating);
+        if (error != std::errc() || (next != end && *next != ' ')) {
+            return false;
+        }
+        ratings.push_back(rating);
+        position = next;
+    }
+}
+
+bool ParseLine(std::string_view line, NewDocument& document) {
+    std::string_view id;
+    std::string_view status;
+    std::string_view ratings;
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (!ReadField(line, id) || !ReadField(line, status) || !ReadField(line, ratings)) {
+        return false;
+    }
+    document.text = line;
+    return ParseInt(id, document.id) && ParseStatus(status, document.status) && ParseRatings(ratings, document.ratings);
+}
+
+} // namespace
+
+CorpusFile::CorpusFile(const std::string& path)
+    : file_(path)
+{
+}
+
+// The batch is cut into parts at line ends, one or more per thread, and the
+// documents of the parts are joined in file order
+bool CorpusFile::ReadBatch(std::vector<NewDocument>& documents, size_t batch_size) {
+    documents.clear();
+    if (position_ == file_.size()) {
+        return false;
+    }
+    const size_t first = position_;
+    const size_t last = FindLineEnd(std::min(file_.size(), first + std::max<size_t>(batch_size, 1)) - 1);
+    const size_t part_count = std::clamp<size_t>((last - first) / min_part_size_, 1,
+        std::max(1u, std::thread::hardware_concurrency()) * 4);
+    std::vector<size_t> part_bounds{ first };
+    for (size_t i = 1; i < part_count; ++i) {
+        part_bounds.push_back(std::max(part_bounds.back(), FindLineEnd(first + (last - first) * i / part_count)));
+    }
+    part_bounds.push_back(last);
+
+    std::vector<std::vector<NewDocument>> part_documents(part_count);
+    std::vector<size_t> line_counts(part_count);
+    std::vector<char> has_errors(part_count);
+    std::vector<size_t> part_indexes(part_count);
+    std::iota(part_indexes.begin(), part_indexes.end(), 0);
+    std::for_each(std::execution::par, part_indexes.begin(), part_indexes.end(), [&](size_t i) {
+        has_errors[i] = !ParseLines(part_bounds[i], part_bounds[i + 1], part_documents[i], line_counts[i]);
+        });
+    // A malformed line leaves the position and the line number where they were
+    size_t line_number = line_number_;
+    for (size_t i = 0; i < part_count; ++i) {
+        if (has_errors[i]) {
+            throw std::invalid_argument("Corpus line "s + std::to_string(line_number + line_counts[i])
+                + " is malformed"s);
+        }
+        line_number += line_counts[i];
+    }
+
+    size_t document_count = 0;
+    for (const std::vector<NewDocument>& part : part_documents) {
+        document_count += part.size();
+    }
+    documents.reserve(document_count);
+    for (std::vector<NewDocument>& part : part_documents) {
+        std::move(part.begin(), part.end(), std::back_inserter(documents));
+    }
+    position_ = last;
+    line_number_ = line_number;
+    return true;
+}
+
+size_t CorpusFile::size() const {
+    return file_.size();
+}
+
+size_t CorpusFile::FindLineEnd(size_t position) const {
+    const void* line_end = std::memchr(file_.data() + position, '\n', file_.size() - position);
+    return line_end == nullptr ? file_.size() : static_cast<const char*>(line_end) - file_.data() + 1;
+}
+
+// Empty lines are skipped
+bool CorpusFile::ParseLines(size_t first, size_t last, std::vector<NewDocument>& documents,
+    size_t& line_count) const {
+    line_count = 0;
+    for (; first < last; ++line_count) {
+        const size_t line_end = FindLineEnd(first);
+        const size_t line_size = line_end - first - (file_.data()[line_end - 1] == '\n' ? 1 : 0);
+        const std::string_view line(file_.data() + first, line_size);
+        if (!line.empty() && line != "\r"sv) {
+            NewDocument document;
+            if (!ParseLine(line, document)) {
+                return false;
+            }
+            documents.push_back(std::move(document));
+        }
+        first = line_end;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "search_server.h"
+
+#include <execution>
+#include <string>
+#include <vector>
+
+// A corpus of one document per line:
+//     id <TAB> status <TAB> ratings <TAB> text
+// where status is ACTUAL, IRRELEVANT, BANNED or REMOVED and ratings are
+// integers separated by spaces, possibly none. The file is memory-mapped and
+// read in batches whose lines are parsed in parallel. Document texts are views
+// of the mapped bytes, so no line is copied, and they stay valid while the
+// CorpusFile lives
+class CorpusFile {
+public:
+    explicit CorpusFile(const std::string& path);
+
+    // Replaces documents with the ones of the next lines, about batch_size
+    // bytes of them. Returns false once the whole file has been read.
+    // Throws std::invalid_argument naming the first malformed line; the
+    // batch is not consumed then, and the next call fails on the same line
+    bool ReadBatch(std::vector<NewDocument>& documents, size_t batch_size = default_batch_size_);
+
+    size_t size() const;
+
+private:
+    const static size_t default_batch_size_ = 16 * 1024 * 1024;
+    const static size_t min_part_size_ = 64 * 1024;     // of a batch parsed by one thread
+
+    MappedFile file_;
+    size_t position_ = 0;
+    size_t line_number_ = 1;                            // of the line at position_
+
+    // Returns the position after the end of the line with position, or the end of the file
+    size_t FindLineEnd(size_t position) const;
+
+    // Parses the lines of [first, last) and counts them. Returns false at the
+    // first malformed line, counting only the lines before it
+    bool ParseLines(size_t first, size_t last, std::vector<NewDocument>& documents, size_t& line_count) const;
+};
+
+// Adds all the documents of the file to the server one by one. The documents
+// before a failed one stay added. Returns the number of added documents
+template <typename Server>
+size_t LoadCorpus(Server& server, const std::string& path) {
+    CorpusFile corpus(path);
+    std::vector<NewDocument> documents;
+    size_t document_count = 0;
+    while (corpus.ReadBatch(documents)) {
+        for (const NewDocument& document : documents) {
+            server.AddDocument(document.id, document.text, document.status, document.ratings);
+        }
+        document_count += documents.size();
+    }
+    return document_count;
+}
+
+// Adds the documents with AddDocuments, a batch at a time, so every batch is
+// tokenized in parallel and added in full or not at all; the batches before
+// a failed one stay added
+template <typename Server>
+size_t LoadCorpus(std::execution::parallel_policy par, Server& server, const std::string& path) {
+    CorpusFile corpus(path);
+    std::vector<NewDocument> documents;
+    size_t document_count = 0;
+    while (corpus.ReadBatch(documents)) {
+        server.AddDocuments(par, documents);
+        document_count += documents.size();
+    }
+    return document_count;
+}
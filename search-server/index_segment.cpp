@@ -0,0 +1,254 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+template <typename T>
+void SaveArray(SnapshotWriter& writer, const SegmentArray<T>& values) {
+    writer.Write(static_cast<uint64_t>(values.size()));
+    writer.Align(alignof(uint64_t));
+    writer.WriteArray(values.data(), values.size());
+}
+
+template <typename T>
+SegmentArray<T> LoadArray(SnapshotReader& reader) {
+    const size_t size = reader.Read<uint64_t>();
+    reader.Align(alignof(uint64_t));
+    return SegmentArray<T>(reader.ReadArrayView<T>(size), size);
+}
+
+template <typename T>
+bool IsStrictlyIncreasing(const SegmentArray<T>& values) {
+    return std::adjacent_find(values.begin(), values.end(), std::greater_equal<T>()) == values.end();
+}
+
+} // namespace
+
+IndexSegment::IndexSegment(std::vector<int> document_ids, std::vector<float> freq_table)
+    : document_ids_(std::move(document_ids))
+    , freq_table_(std::move(freq_table))
+    , term_postings_(std::vector<TermPostings>(1))
+{
+}
+
+void IndexSegment::AppendTerm(uint32_t term_id, PostingList::Cursor postings) {
+    std::vector<int> ids;
+    std::vector<uint32_t> freq_codes;
+    for (; !postings.IsEnd(); postings.Next()) {
+        ids.push_back(postings.GetDocumentId());
+        freq_codes.push_back(static_cast<uint32_t>(
+            std::lower_bound(freq_table_.begin(), freq_table_.end(), postings.GetTermFreq()) - freq_table_.begin()));
+    }
+    AppendPostings(term_id, ids, freq_codes);
+}
+
+void IndexSegment::ShrinkToFit() {
+    term_ids_.GetValues().shrink_to_fit();
+    term_postings_.GetValues().shrink_to_fit();
+    blocks_.GetValues().shrink_to_fit();
+    data_.GetValues().shrink_to_fit();
+}
+
+std::optional<PostingList::Cursor> IndexSegment::FindPostings(uint32_t term_id) const {
+    const auto it = std::lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id) {
+        return std::nullopt;
+    }
+    return OpenPostings(it - term_ids_.begin());
+}
+
+const SegmentArray<int>& IndexSegment::GetDocumentIds() const {
+    return document_ids_;
+}
+
+size_t IndexSegment::GetDocumentCount() const {
+    return document_ids_.size();
+}
+
+size_t IndexSegment::GetPostingCount() const {
+    return term_postings_.back().posting_offset;
+}
+
+size_t IndexSegment::GetMemoryUsage() const {
+    return document_ids_.GetMemoryUsage()
+        + freq_table_.GetMemoryUsage()
+        + term_ids_.GetMemoryUsage()
+        + term_postings_.GetMemoryUsage()
+        + blocks_.GetMemoryUsage()
+        + data_.GetMemoryUsage();
+}
+
+void IndexSegment::Save(SnapshotWriter& writer) const {
+    SaveArray(writer, document_ids_);
+    SaveArray(writer, freq_table_);
+    SaveArray(writer, term_ids_);
+    SaveArray(writer, term_postings_);
+    SaveArray(writer, blocks_);
+    SaveArray(writer, data_);
+}
+
+IndexSegment IndexSegment::Load(SnapshotReader& reader, std::shared_ptr<const void> storage) {
+    using namespace std::literals;
+    IndexSegment segment;
+    segment.document_ids_ = LoadArray<int>(reader);
+    segment.freq_table_ = LoadArray<float>(reader);
+    segment.term_ids_ = LoadArray<uint32_t>(reader);
+    segment.term_postings_ = LoadArray<TermPostings>(reader);
+    segment.blocks_ = LoadArray<PackedBlock>(reader);
+    segment.data_ = LoadArray<uint8_t>(reader);
+    segment.storage_ = std::move(storage);
+
+    const SegmentArray<TermPostings>& terms = segment.term_postings_;
+    bool is_valid = IsStrictlyIncreasing(segment.document_ids_) && IsStrictlyIncreasing(segment.freq_table_)
+        && IsStrictlyIncreasing(segment.term_ids_) && terms.size() == segment.term_ids_.size() + 1
+        && terms[0].posting_offset == 0 && terms[0].block_offset == 0 && terms[0].data_offset == 0
+        && terms.back().block_offset == segment.blocks_.size() && terms.back().data_offset == segment.data_.size();
+    for (size_t i = 0; is_valid && i + 1 < terms.size(); ++i) {
+        const size_t posting_count = terms[i + 1].posting_offset - terms[i].posting_offset;
+        is_valid = terms[i + 1].posting_offset > terms[i].posting_offset
+            && terms[i + 1].block_offset - terms[i].block_offset == posting_count / POSTING_BLOCK_SIZE
+            && terms[i + 1].data_offset >= terms[i].data_offset;
+        for (uint32_t block = terms[i].block_offset; is_valid && block < terms[i + 1].block_offset; ++block) {
+            const PackedBlock& packed_block = segment.blocks_[block];
+            is_valid = packed_block.data_offset <= terms[i + 1].data_offset - terms[i].data_offset
+                && packed_block.gap_bit_width <= 32 && packed_block.code_bit_width <= 32;
+        }
+    }
+    if (!is_valid) {
+        throw std::runtime_error("Snapshot has an invalid index segment"s);
+    }
+    return segment;
+}
+
+// The term lists of the segments are walked together like in a k-way merge.
+// Segments usually cover disjoint ranges of ids, so the postings of a term
+// are mostly concatenated and only sorted if the ranges overlap
+IndexSegment IndexSegment::Merge(const std::vector<const IndexSegment*>& segments,
+    const std::vector<std::vector<int>>& removed_document_ids) {
+    std::vector<int> document_ids;
+    std::vector<float> freq_table;
+    size_t term_count = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::set_difference(segments[i]->document_ids_.begin(), segments[i]->document_ids_.end(),
+            removed_document_ids[i].begin(), removed_document_ids[i].end(), std::back_inserter(document_ids));
+        freq_table.insert(freq_table.end(), segments[i]->freq_table_.begin(), segments[i]->freq_table_.end());
+        term_count += segments[i]->term_ids_.size();
+    }
+    std::sort(document_ids.begin(), document_ids.end());
+    std::sort(freq_table.begin(), freq_table.end());
+    freq_table.erase(std::unique(freq_table.begin(), freq_table.end()), freq_table.end());
+
+    std::vector<std::vector<uint32_t>> code_maps(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (float freq : segments[i]->freq_table_) {
+            code_maps[i].push_back(static_cast<uint32_t>(
+                std::lower_bound(freq_table.begin(), freq_table.end(), freq) - freq_table.begin()));
+        }
+    }
+    IndexSegment merged(std::move(document_ids), std::move(freq_table));
+    merged.term_ids_.GetValues().reserve(term_count);
+    merged.term_postings_.GetValues().reserve(term_count + 1);
+
+    std::vector<size_t> positions(segments.size(), 0);
+    std::vector<int> ids;
+    std::vector<uint32_t> freq_codes;
+    std::vector<size_t> order;
+    std::vector<int> sorted_ids;
+    std::vector<uint32_t> sorted_freq_codes;
+    while (true) {
+        uint32_t term_id = std::numeric_limits<uint32_t>::max();
+        bool found = false;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (positions[i] < segments[i]->term_ids_.size() && segments[i]->term_ids_[positions[i]] <= term_id) {
+                term_id = segments[i]->term_ids_[positions[i]];
+                found = true;
+            }
+        }
+        if (!found) {
+            break;
+        }
+
+        ids.clear();
+        freq_codes.clear();
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (positions[i] < segments[i]->term_ids_.size() && segments[i]->term_ids_[positions[i]] == term_id) {
+                segments[i]->DecodePostings(positions[i]++, code_maps[i], removed_document_ids[i], ids, freq_codes);
+            }
+        }
+        if (!std::is_sorted(ids.begin(), ids.end())) {
+            order.resize(ids.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&ids](size_t lhs, size_t rhs) {return ids[lhs] < ids[rhs]; });
+            sorted_ids.clear();
+            sorted_freq_codes.clear();
+            for (size_t i : order) {
+                sorted_ids.push_back(ids[i]);
+                sorted_freq_codes.push_back(freq_codes[i]);
+            }
+            ids.swap(sorted_ids);
+            freq_codes.swap(sorted_freq_codes);
+        }
+        merged.AppendPostings(term_id, ids, freq_codes);
+    }
+    merged.ShrinkToFit();
+    return merged;
+}
+
+PostingList::Cursor IndexSegment::OpenPostings(size_t term_index) const {
+    return PostingList::Cursor(GetPackedPostings(term_index));
+}
+
+PackedPostings IndexSegment::GetPackedPostings(size_t term_index) const {
+    const TermPostings& term = term_postings_[term_index];
+    PackedPostings postings;
+    postings.blocks = blocks_.data() + term.block_offset;
+    postings.data = data_.data() + term.data_offset;
+    postings.freq_table = freq_table_.data();
+    postings.size = term_postings_[term_index + 1].posting_offset - term.posting_offset;
+    postings.max_term_freq = term.max_term_freq;
+    return postings;
+}
+
+void IndexSegment::AppendPostings(uint32_t term_id, const std::vector<int>& ids,
+    const std::vector<uint32_t>& freq_codes) {
+    using namespace std::literals;
+    if (ids.empty()) {
+        return;
+    }
+    std::vector<TermPostings>& term_postings = term_postings_.GetValues();
+    PackPostings(ids, freq_codes, freq_table_.GetValues(), blocks_.GetValues(), data_.GetValues());
+    const size_t posting_count = term_postings.back().posting_offset + ids.size();
+    if (posting_count > std::numeric_limits<uint32_t>::max() || data_.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::length_error("Index segment is too large"s);
+    }
+    term_ids_.GetValues().push_back(term_id);
+    term_postings.back().max_term_freq = freq_table_[*std::max_element(freq_codes.begin(), freq_codes.end())];
+    term_postings.push_back({ static_cast<uint32_t>(posting_count), static_cast<uint32_t>(blocks_.size()),
+        static_cast<uint32_t>(data_.size()), 0.0f });
+}
+
+void IndexSegment::DecodePostings(size_t term_index, const std::vector<uint32_t>& code_map,
+    const std::vector<int>& removed_document_ids, std::vector<int>& ids, std::vector<uint32_t>& freq_codes) const {
+    const PackedPostings postings = GetPackedPostings(term_index);
+    std::array<int, POSTING_BLOCK_SIZE> block_ids;
+    std::array<uint32_t, POSTING_BLOCK_SIZE> block_freq_codes;
+    for (size_t block = 0; block * POSTING_BLOCK_SIZE < postings.size; ++block) {
+        const size_t size = UnpackBlockIds(postings, block, block_ids.data());
+        UnpackBlockFreqCodes(postings, block, block_freq_codes.data());
+        for (size_t i = 0; i < size; ++i) {
+            if (removed_document_ids.empty()
+                || !std::binary_search(removed_document_ids.begin(), removed_document_ids.end(), block_ids[i])) {
+                ids.push_back(block_ids[i]);
+                freq_codes.push_back(code_map[block_freq_codes[i]]);
+            }
+        }
+    }
+}
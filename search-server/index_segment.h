@@ -0,0 +1,150 @@
+#pragma once
+
+#include "posting_codec.h"
+#include "posting_list.h"
+#include "snapshot.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Array of an index segment: owned while the segment is built, or a view of
+// memory the segment keeps alive, like a mapped snapshot
+template <typename T>
+class SegmentArray {
+public:
+    SegmentArray() = default;
+
+    explicit SegmentArray(std::vector<T> values)
+        : values_(std::move(values)) {
+    }
+
+    SegmentArray(const T* data, size_t size)
+        : data_(data)
+        , size_(size)
+        , is_view_(true) {
+    }
+
+    const T* data() const {
+        return is_view_ ? data_ : values_.data();
+    }
+
+    size_t size() const {
+        return is_view_ ? size_ : values_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    const T& back() const {
+        return data()[size() - 1];
+    }
+
+    // The owned values of an array being built; a view has none
+    std::vector<T>& GetValues() {
+        return values_;
+    }
+
+    // Heap usage in bytes; a view takes none
+    size_t GetMemoryUsage() const {
+        return values_.capacity() * sizeof(T);
+    }
+
+private:
+    std::vector<T> values_;
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+    bool is_view_ = false;
+};
+
+// Postings of a fixed set of documents, compressed as described in
+// posting_codec.h. The postings of all the terms are stored back to back in
+// a few flat arrays, so a segment costs a handful of allocations however many
+// terms it has. A segment never changes once it is built, so it can be shared
+// and read without locks; removed documents are dropped by building a new
+// segment with Merge. A segment loaded from a snapshot reads its arrays in
+// place from the snapshot memory
+class IndexSegment {
+public:
+    // freq_table holds the distinct term frequencies of all the postings, sorted
+    IndexSegment(std::vector<int> document_ids, std::vector<float> freq_table);
+
+    // Fills the segment before it is shared. Terms must come in ascending id
+    // order; a term without postings is skipped
+    void AppendTerm(uint32_t term_id, PostingList::Cursor postings);
+
+    // Releases the memory reserved while the segment was filled
+    void ShrinkToFit();
+
+    // Returns std::nullopt if no document of the segment has the term
+    std::optional<PostingList::Cursor> FindPostings(uint32_t term_id) const;
+
+    // Sorted ids of all the documents the segment was built from
+    const SegmentArray<int>& GetDocumentIds() const;
+
+    size_t GetDocumentCount() const;
+
+    size_t GetPostingCount() const;
+
+    // Approximate heap usage in bytes; arrays read in place from a snapshot
+    // are not counted
+    size_t GetMemoryUsage() const;
+
+    // Writes the arrays aligned, so Load can read them in place
+    void Save(SnapshotWriter& writer) const;
+
+    // The arrays of the segment point into the memory of the reader, which
+    // storage must keep alive. Offsets are checked; the postings themselves
+    // are trusted once the snapshot checksum matches
+    static IndexSegment Load(SnapshotReader& reader, std::shared_ptr<const void> storage);
+
+    // Merges the postings of the segments, leaving out the documents in
+    // removed_document_ids. The segments must not share live documents, and
+    // the removed ids of every segment must be sorted
+    static IndexSegment Merge(const std::vector<const IndexSegment*>& segments,
+        const std::vector<std::vector<int>>& removed_document_ids);
+
+private:
+    // Where the postings of a term start; the end is the start of the next term
+    struct TermPostings {
+        uint32_t posting_offset = 0;
+        uint32_t block_offset = 0;
+        uint32_t data_offset = 0;
+        float max_term_freq = 0.0f;
+    };
+
+    SegmentArray<int> document_ids_;
+    SegmentArray<float> freq_table_;
+    SegmentArray<uint32_t> term_ids_;
+    SegmentArray<TermPostings> term_postings_;  // one more than term_ids_
+    SegmentArray<PackedBlock> blocks_;
+    SegmentArray<uint8_t> data_;
+    std::shared_ptr<const void> storage_;       // of the views, if the segment was loaded
+
+    IndexSegment() = default;
+
+    PostingList::Cursor OpenPostings(size_t term_index) const;
+
+    PackedPostings GetPackedPostings(size_t term_index) const;
+
+    void AppendPostings(uint32_t term_id, const std::vector<int>& ids, const std::vector<uint32_t>& freq_codes);
+
+    // Appends the postings of a term which are not removed, with their
+    // frequency codes translated by code_map
+    void DecodePostings(size_t term_index, const std::vector<uint32_t>& code_map, const std::vector<int>& removed_document_ids,
+        std::vector<int>& ids, std::vector<uint32_t>& freq_codes) const;
+};
@@ -1,5 +1,7 @@
-﻿#include "process_queries.h"
+﻿#include "benchmark_functions.h"
+#include "process_queries.h"
 #include "search_server.h"
+#include "test_example_functions.h"
 #include <execution>
 #include <iostream>
 #include <string>
@@ -11,7 +13,14 @@ void PrintDocument(const Document& document) {
         << "relevance = "s << document.relevance << ", "s
         << "rating = "s << document.rating << " }"s << endl;
 }
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && argv[1] == "--test"s) {
+        TestSearchServer();
+        return 0;
+    }
+    if (argc > 1 && argv[1] == "--benchmark"s) {
+        return RunBenchmark(argc > 2 ? argv[2] : "all"s) ? 0 : 1;
+    }
     SearchServer search_server("and with"s);
     int id = 0;
     for (
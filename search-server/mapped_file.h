@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file; pages are loaded by the OS on
+// first access instead of being copied through a stream buffer
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    const char* data() const;
+
+    size_t size() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
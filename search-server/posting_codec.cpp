@@ -0,0 +1,285 @@
+#include "posting_codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define POSTING_CODEC_SSE2
+#endif
+
+namespace {
+
+const size_t LANE_COUNT = 4;
+const size_t LANE_SIZE = POSTING_BLOCK_SIZE / LANE_COUNT;
+
+using Values = std::array<uint32_t, POSTING_BLOCK_SIZE>;
+
+uint8_t GetBitWidth(uint32_t value) {
+    uint8_t bit_width = 0;
+    for (; value != 0; value >>= 1) {
+        ++bit_width;
+    }
+    return bit_width;
+}
+
+uint8_t GetBitWidth(const Values& values) {
+    uint32_t all_bits = 0;
+    for (uint32_t value : values) {
+        all_bits |= value;
+    }
+    return GetBitWidth(all_bits);
+}
+
+size_t GetPackedSize(uint8_t bit_width) {
+    return (LANE_SIZE * bit_width + 31) / 32 * LANE_COUNT * sizeof(uint32_t);
+}
+
+void PackValues(const Values& values, uint8_t bit_width, std::vector<uint8_t>& data) {
+    Values words = {};
+    if (bit_width > 0) {
+        for (size_t j = 0; j < LANE_SIZE; ++j) {
+            const size_t bit = j * bit_width;
+            const size_t shift = bit % 32;
+            const size_t word = bit / 32 * LANE_COUNT;
+            for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+                const uint32_t value = values[j * LANE_COUNT + lane];
+                words[word + lane] |= value << shift;
+                if (shift + bit_width > 32) {
+                    words[word + LANE_COUNT + lane] |= value >> (32 - shift);
+                }
+            }
+        }
+    }
+    const size_t size = GetPackedSize(bit_width);
+    const size_t offset = data.size();
+    data.resize(offset + size);
+    std::memcpy(data.data() + offset, words.data(), size);
+}
+
+#ifdef POSTING_CODEC_SSE2
+
+// Every step unpacks values 4 * j ... 4 * j + 3, one from each lane. Gaps are
+// turned into ids with a prefix sum inside the register
+template <size_t bit_width, bool is_gaps>
+void UnpackOfWidth(const uint8_t* data, int base, uint32_t* values) {
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(bit_width == 32 ? ~0u : (1u << bit_width) - 1));
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i previous = _mm_set1_epi32(base);
+    for (size_t j = 0; j < LANE_SIZE; ++j) {
+        __m128i unpacked = _mm_setzero_si128();
+        if constexpr (bit_width > 0) {
+            const size_t bit = j * bit_width;
+            const size_t shift = bit % 32;
+            const __m128i* words = reinterpret_cast<const __m128i*>(data) + bit / 32;
+            unpacked = _mm_srl_epi32(_mm_loadu_si128(words), _mm_cvtsi32_si128(static_cast<int>(shift)));
+            if (shift + bit_width > 32) {
+                unpacked = _mm_or_si128(unpacked, _mm_sll_epi32(_mm_loadu_si128(words + 1),
+                    _mm_cvtsi32_si128(static_cast<int>(32 - shift))));
+            }
+            unpacked = _mm_and_si128(unpacked, mask);
+        }
+        if constexpr (is_gaps) {
+            unpacked = _mm_add_epi32(unpacked, one);
+            unpacked = _mm_add_epi32(unpacked, _mm_slli_si128(unpacked, 4));
+            unpacked = _mm_add_epi32(unpacked, _mm_slli_si128(unpacked, 8));
+            unpacked = _mm_add_epi32(unpacked, previous);
+            previous = _mm_shuffle_epi32(unpacked, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + j * LANE_COUNT), unpacked);
+    }
+}
+
+#else
+
+template <size_t bit_width, bool is_gaps>
+void UnpackOfWidth(const uint8_t* data, int base, uint32_t* values) {
+    const uint32_t mask = bit_width == 32 ? ~0u : (1u << bit_width) - 1;
+    Values words = {};
+    std::memcpy(words.data(), data, GetPackedSize(bit_width));
+    uint32_t previous = static_cast<uint32_t>(base);
+    for (size_t j = 0; j < LANE_SIZE; ++j) {
+        const size_t bit = j * bit_width;
+        const size_t shift = bit % 32;
+        const size_t word = bit / 32 * LANE_COUNT;
+        for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+            uint32_t value = 0;
+            if constexpr (bit_width > 0) {
+                value = words[word + lane] >> shift;
+                if (shift + bit_width > 32) {
+                    value |= words[word + LANE_COUNT + lane] << (32 - shift);
+                }
+                value &= mask;
+            }
+            if constexpr (is_gaps) {
+                previous += value + 1;
+                value = previous;
+            }
+            values[j * LANE_COUNT + lane] = value;
+        }
+    }
+}
+
+#endif
+
+using UnpackFunction = void (*)(const uint8_t*, int, uint32_t*);
+
+template <bool is_gaps, size_t... bit_widths>
+constexpr std::array<UnpackFunction, sizeof...(bit_widths)> MakeUnpackFunctions(std::index_sequence<bit_widths...>) {
+    return { &UnpackOfWidth<bit_widths, is_gaps>... };
+}
+
+// A separate function for every width lets the compiler turn the shifts into constants
+const auto UNPACK_GAP_FUNCTIONS = MakeUnpackFunctions<true>(std::make_index_sequence<33>());
+const auto UNPACK_CODE_FUNCTIONS = MakeUnpackFunctions<false>(std::make_index_sequence<33>());
+
+void AppendVarint(uint32_t value, std::vector<uint8_t>& data) {
+    while (value >= 0x80) {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t ReadVarint(const uint8_t*& data) {
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+// Values of a tail go one after another, the lowest bit first, and the last
+// byte is padded with zeros
+void AppendBits(const uint32_t* values, size_t count, uint8_t bit_width, std::vector<uint8_t>& data) {
+    uint64_t bits = 0;
+    size_t bit_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bits |= static_cast<uint64_t>(values[i]) << bit_count;
+        for (bit_count += bit_width; bit_count >= 8; bit_count -= 8) {
+            data.push_back(static_cast<uint8_t>(bits));
+            bits >>= 8;
+        }
+    }
+    if (bit_count > 0) {
+        data.push_back(static_cast<uint8_t>(bits));
+    }
+}
+
+// Reads byte by byte, so nothing past the padded last byte is touched
+void ReadBits(const uint8_t* data, size_t count, uint8_t bit_width, uint32_t* values) {
+    const uint64_t mask = (uint64_t{ 1 } << bit_width) - 1;
+    uint64_t bits = 0;
+    size_t bit_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        for (; bit_count < bit_width; bit_count += 8) {
+            bits |= static_cast<uint64_t>(*data++) << bit_count;
+        }
+        values[i] = static_cast<uint32_t>(bits & mask);
+        bits >>= bit_width;
+        bit_count -= bit_width;
+    }
+}
+
+size_t GetBitsSize(size_t count, uint8_t bit_width) {
+    return (count * bit_width + 7) / 8;
+}
+
+const uint8_t* GetTailData(const PackedPostings& postings, size_t full_block_count) {
+    if (full_block_count == 0) {
+        return postings.data;
+    }
+    const PackedBlock& last_block = postings.blocks[full_block_count - 1];
+    return postings.data + last_block.data_offset + GetPackedSize(last_block.gap_bit_width)
+        + GetPackedSize(last_block.code_bit_width);
+}
+
+} // namespace
+
+void PackPostings(const std::vector<int>& ids, const std::vector<uint32_t>& freq_codes,
+    const std::vector<float>& freq_table, std::vector<PackedBlock>& blocks, std::vector<uint8_t>& data) {
+    const size_t first_data = data.size();
+    Values gaps;
+    Values codes;
+    int previous = -1;
+    size_t pos = 0;
+    for (; pos + POSTING_BLOCK_SIZE <= ids.size(); pos += POSTING_BLOCK_SIZE) {
+        for (size_t i = 0; i < POSTING_BLOCK_SIZE; ++i) {
+            gaps[i] = static_cast<uint32_t>(ids[pos + i] - previous - 1);
+            previous = ids[pos + i];
+            codes[i] = freq_codes[pos + i];
+        }
+        const uint8_t gap_bit_width = GetBitWidth(gaps);
+        const uint8_t code_bit_width = GetBitWidth(codes);
+        blocks.push_back({ previous, static_cast<uint32_t>(data.size() - first_data),
+            freq_table[*std::max_element(codes.begin(), codes.end())], gap_bit_width, code_bit_width });
+        PackValues(gaps, gap_bit_width, data);
+        PackValues(codes, code_bit_width, data);
+    }
+    if (pos == ids.size()) {
+        return;
+    }
+    const size_t tail_size = ids.size() - pos;
+    uint32_t all_gap_bits = 0;
+    for (size_t i = 0; i < tail_size; ++i) {
+        gaps[i] = static_cast<uint32_t>(ids[pos + i] - previous - 1);
+        previous = ids[pos + i];
+        all_gap_bits |= gaps[i];
+    }
+    const uint8_t gap_bit_width = GetBitWidth(all_gap_bits);
+    data.push_back(gap_bit_width);
+    AppendBits(gaps.data(), tail_size, gap_bit_width, data);
+    for (size_t run_end = pos; pos < ids.size(); pos = run_end) {
+        while (run_end < ids.size() && freq_codes[run_end] == freq_codes[pos]) {
+            ++run_end;
+        }
+        AppendVarint(static_cast<uint32_t>(run_end - pos), data);
+        AppendVarint(freq_codes[pos], data);
+    }
+}
+
+size_t UnpackBlockIds(const PackedPostings& postings, size_t block, int* ids) {
+    const size_t full_block_count = postings.size / POSTING_BLOCK_SIZE;
+    const int base = block == 0 ? -1 : postings.blocks[block - 1].last_document_id;
+    if (block < full_block_count) {
+        const PackedBlock& packed_block = postings.blocks[block];
+        UNPACK_GAP_FUNCTIONS[packed_block.gap_bit_width](postings.data + packed_block.data_offset, base,
+            reinterpret_cast<uint32_t*>(ids));
+        return POSTING_BLOCK_SIZE;
+    }
+    const size_t size = postings.size - full_block_count * POSTING_BLOCK_SIZE;
+    const uint8_t* data = GetTailData(postings, full_block_count);
+    uint32_t* gaps = reinterpret_cast<uint32_t*>(ids);
+    ReadBits(data + 1, size, data[0], gaps);
+    int previous = base;
+    for (size_t i = 0; i < size; ++i) {
+        previous += static_cast<int>(gaps[i]) + 1;
+        ids[i] = previous;
+    }
+    return size;
+}
+
+size_t UnpackBlockFreqCodes(const PackedPostings& postings, size_t block, uint32_t* freq_codes) {
+    const size_t full_block_count = postings.size / POSTING_BLOCK_SIZE;
+    if (block < full_block_count) {
+        const PackedBlock& packed_block = postings.blocks[block];
+        UNPACK_CODE_FUNCTIONS[packed_block.code_bit_width](
+            postings.data + packed_block.data_offset + GetPackedSize(packed_block.gap_bit_width), 0, freq_codes);
+        return POSTING_BLOCK_SIZE;
+    }
+    const size_t size = postings.size - full_block_count * POSTING_BLOCK_SIZE;
+    const uint8_t* data = GetTailData(postings, full_block_count);
+    data += 1 + GetBitsSize(size, data[0]);
+    for (size_t i = 0; i < size;) {
+        const size_t run_size = std::clamp<size_t>(ReadVarint(data), 1, size - i);
+        const uint32_t freq_code = ReadVarint(data);
+        std::fill(freq_codes + i, freq_codes + i + run_size, freq_code);
+        i += run_size;
+    }
+    return size;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed form of posting lists used by sealed index segments.
+// Document ids are stored as gaps: the id minus the previous id minus one.
+// Term frequencies are stored as codes: indexes in a sorted table of the
+// distinct frequencies of a segment, so scores stay exact.
+// Every full block of POSTING_BLOCK_SIZE postings bit-packs its gaps and then
+// its codes, each with the width of its largest value.
+// Packed values are split into 4 lanes of 32-bit words, value i going to lane
+// i % 4, so 4 consecutive values are unpacked at once with SSE2.
+// The remaining postings of a list form a tail: a byte with the width of its
+// largest gap, the gaps bit-packed with that width, and then the codes as
+// varint pairs of a run length and a code, since most tail postings of a
+// list share their frequency.
+// On BenchmarkPostingCodec (1M documents, 7.9M postings) the packed lists take
+// 1.94 B/posting: gaps 1.25, tails 0.47, block headers 0.19, frequency codes
+// 0.03. That is 4.2x smaller than the flat lists (8.09 B/posting) and 25x
+// smaller than the nested std::map index they replaced (48 B/posting). Gaps of
+// rare words need about 10 bits, which bounds the ratio to the flat lists.
+// The server reports 3.77 B/posting, as every segment adds its document ids, a
+// directory entry and a tail per term, and the mutable segment stays flat
+
+const size_t POSTING_BLOCK_SIZE = 64;
+
+struct PackedBlock {
+    int last_document_id;
+    uint32_t data_offset;           // from the start of the list data
+    float max_term_freq;
+    uint8_t gap_bit_width;
+    uint8_t code_bit_width;
+};
+
+// A posting list packed with PackPostings
+struct PackedPostings {
+    const PackedBlock* blocks = nullptr;        // size / POSTING_BLOCK_SIZE full blocks
+    const uint8_t* data = nullptr;
+    const float* freq_table = nullptr;
+    size_t size = 0;
+    float max_term_freq = 0.0f;
+};
+
+// Appends the blocks and the data of a list with sorted ids
+void PackPostings(const std::vector<int>& ids, const std::vector<uint32_t>& freq_codes,
+    const std::vector<float>& freq_table, std::vector<PackedBlock>& blocks, std::vector<uint8_t>& data);
+
+// Decodes the ids of a block and returns their count
+size_t UnpackBlockIds(const PackedPostings& postings, size_t block, int* ids);
+
+// Decodes the frequency codes of a block and returns their count
+size_t UnpackBlockFreqCodes(const PackedPostings& postings, size_t block, uint32_t* freq_codes);
@@ -0,0 +1,287 @@
+#include "posting_list.h"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Galloping search: skips are usually short, so probe 1, 2, 4... positions
+// ahead before falling back to a binary search in the last interval
+template <typename Item, typename GetDocumentId>
+size_t GallopTo(const Item* items, size_t size, size_t pos, int document_id, GetDocumentId get_document_id) {
+    size_t step = 1;
+    size_t low = pos;
+    size_t high = pos;
+    while (high < size && get_document_id(items[high]) < document_id) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    high = std::min(high, size);
+    return std::partition_point(items + low, items + high, [&](const Item& item) {
+        return get_document_id(item) < document_id; }) - items;
+}
+
+size_t GallopTo(const int* ids, size_t size, size_t pos, int document_id) {
+    return GallopTo(ids, size, pos, document_id, [](int id) {return id; });
+}
+
+} // namespace
+
+PostingList::Cursor::Cursor(const PostingList& postings)
+    : ids_(postings.ids_.data())
+    , freqs_(postings.freqs_.data())
+    , block_max_freqs_(postings.block_max_freqs_.data())
+    , size_(postings.ids_.size())
+    , delta_ids_(postings.delta_ids_.data())
+    , delta_freqs_(postings.delta_freqs_.data())
+    , delta_size_(postings.delta_ids_.size())
+    , delta_max_freq_(postings.delta_max_freq_)
+    , max_term_freq_(postings.max_term_freq_)
+{
+    Settle();
+}
+
+PostingList::Cursor::Cursor(const PackedPostings& postings)
+    : size_(postings.size)
+    , max_term_freq_(postings.max_term_freq)
+    , is_packed_(true)
+    , packed_(postings)
+{
+    if (size_ > 0) {
+        LoadBlock(0);
+    }
+}
+
+bool PostingList::Cursor::IsEnd() const {
+    return pos_ == size_ && delta_pos_ == delta_size_;
+}
+
+int PostingList::Cursor::GetDocumentId() const {
+    if (in_delta_) {
+        return delta_ids_[delta_pos_];
+    }
+    return is_packed_ ? block_ids_[pos_ % block_size_] : ids_[pos_];
+}
+
+float PostingList::Cursor::GetTermFreq() const {
+    if (in_delta_) {
+        return delta_freqs_[delta_pos_];
+    }
+    if (!is_packed_) {
+        return freqs_[pos_];
+    }
+    if (!has_block_freqs_) {
+        LoadBlockFreqs();
+    }
+    return block_freqs_[pos_ % block_size_];
+}
+
+void PostingList::Cursor::Next() {
+    if (in_delta_) {
+        ++delta_pos_;
+    }
+    else {
+        ++pos_;
+        if (is_packed_ && pos_ < size_ && pos_ % block_size_ == 0) {
+            LoadBlock(pos_ / block_size_);
+        }
+    }
+    Settle();
+}
+
+void PostingList::Cursor::SkipTo(int document_id) {
+    if (!is_packed_) {
+        pos_ = GallopTo(ids_, size_, pos_, document_id);
+    }
+    else if (pos_ < size_) {
+        // Whole blocks ending before document_id are passed without decoding them
+        const size_t full_block_count = size_ / block_size_;
+        size_t block = pos_ / block_size_;
+        if (block < full_block_count && packed_.blocks[block].last_document_id < document_id) {
+            block = GallopTo(packed_.blocks, full_block_count, block + 1, document_id,
+                [](const PackedBlock& packed_block) {return packed_block.last_document_id; });
+            pos_ = block * block_size_;
+            if (pos_ < size_) {
+                LoadBlock(block);
+            }
+        }
+        if (pos_ < size_) {
+            const size_t block_first = block * block_size_;
+            const size_t block_size = std::min(POSTING_BLOCK_SIZE, size_ - block_first);
+            pos_ = block_first + GallopTo(block_ids_.data(), block_size, pos_ - block_first, document_id);
+            pos_ = std::min(pos_, size_);
+            if (pos_ < size_ && pos_ % block_size_ == 0) {
+                LoadBlock(pos_ / block_size_);
+            }
+        }
+    }
+    delta_pos_ = GallopTo(delta_ids_, delta_size_, delta_pos_, document_id);
+    Settle();
+}
+
+int PostingList::Cursor::GetBlockLastDocumentId() const {
+    int last_document_id = std::numeric_limits<int>::max();
+    if (pos_ < size_) {
+        const size_t block = pos_ / block_size_;
+        const size_t block_end = std::min(size_, (block + 1) * block_size_);
+        if (!is_packed_) {
+            last_document_id = ids_[block_end - 1];
+        }
+        else if (block < size_ / block_size_) {
+            last_document_id = packed_.blocks[block].last_document_id;
+        }
+        else {
+            last_document_id = block_ids_[(block_end - 1) % block_size_];
+        }
+    }
+    if (delta_pos_ < delta_size_) {
+        last_document_id = std::min(last_document_id, delta_ids_[delta_size_ - 1]);
+    }
+    return last_document_id;
+}
+
+float PostingList::Cursor::GetBlockMaxTermFreq() const {
+    float max_freq = 0.0f;
+    if (pos_ < size_) {
+        const size_t block = pos_ / block_size_;
+        if (!is_packed_) {
+            max_freq = block_max_freqs_[block];
+        }
+        else {
+            // The tail after the full blocks has no header and is bounded by the whole list
+            max_freq = block < size_ / block_size_ ? packed_.blocks[block].max_term_freq : max_term_freq_;
+        }
+    }
+    if (delta_pos_ < delta_size_) {
+        max_freq = std::max(max_freq, delta_max_freq_);
+    }
+    return max_freq;
+}
+
+float PostingList::Cursor::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+void PostingList::Cursor::AddBlockLastDocumentIds(std::vector<int>& ids) const {
+    const size_t full_block_count = size_ / block_size_;
+    for (size_t block = 0; block < full_block_count; ++block) {
+        ids.push_back(is_packed_ ? packed_.blocks[block].last_document_id : ids_[(block + 1) * block_size_ - 1]);
+    }
+    for (size_t pos = block_size_ - 1; pos < delta_size_; pos += block_size_) {
+        ids.push_back(delta_ids_[pos]);
+    }
+}
+
+void PostingList::Cursor::Settle() {
+    const bool has_main = pos_ < size_;
+    const bool has_delta = delta_pos_ < delta_size_;     // never true for packed postings
+    in_delta_ = has_delta && (!has_main || delta_ids_[delta_pos_] < ids_[pos_]);
+}
+
+void PostingList::Cursor::LoadBlock(size_t block) {
+    UnpackBlockIds(packed_, block, block_ids_.data());
+    has_block_freqs_ = false;
+}
+
+void PostingList::Cursor::LoadBlockFreqs() const {
+    std::array<uint32_t, block_size_> freq_codes;
+    const size_t size = UnpackBlockFreqCodes(packed_, pos_ / block_size_, freq_codes.data());
+    for (size_t i = 0; i < size; ++i) {
+        block_freqs_[i] = packed_.freq_table[freq_codes[i]];
+    }
+    has_block_freqs_ = true;
+}
+
+PostingList::PostingList(Cursor postings) {
+    for (; !postings.IsEnd(); postings.Next()) {
+        ids_.push_back(postings.GetDocumentId());
+        freqs_.push_back(postings.GetTermFreq());
+        max_term_freq_ = std::max(max_term_freq_, postings.GetTermFreq());
+    }
+    UpdateBlockMaxFreqs(0);
+}
+
+void PostingList::Add(int document_id, float term_freq) {
+    max_term_freq_ = std::max(max_term_freq_, term_freq);
+    if (ids_.empty() || ids_.back() < document_id) {
+        ids_.push_back(document_id);
+        freqs_.push_back(term_freq);
+        UpdateBlockMaxFreqs(ids_.size() - 1);
+        return;
+    }
+    const auto it = std::upper_bound(delta_ids_.begin(), delta_ids_.end(), document_id);
+    delta_freqs_.insert(delta_freqs_.begin() + (it - delta_ids_.begin()), term_freq);
+    delta_ids_.insert(it, document_id);
+    delta_max_freq_ = std::max(delta_max_freq_, term_freq);
+    if (delta_ids_.size() > GetMaxDeltaSize()) {
+        Merge();
+    }
+}
+
+void PostingList::Merge() {
+    if (delta_ids_.empty()) {
+        return;
+    }
+    std::vector<int> ids;
+    std::vector<float> freqs;
+    ids.reserve(ids_.size() + delta_ids_.size());
+    freqs.reserve(ids_.size() + delta_ids_.size());
+    for (Cursor cursor(*this); !cursor.IsEnd(); cursor.Next()) {
+        ids.push_back(cursor.GetDocumentId());
+        freqs.push_back(cursor.GetTermFreq());
+    }
+
+    ids_.swap(ids);
+    freqs_.swap(freqs);
+    delta_ids_.clear();
+    delta_freqs_.clear();
+    delta_max_freq_ = 0.0f;
+    UpdateBlockMaxFreqs(0);
+}
+
+void PostingList::Clear() {
+    max_term_freq_ = 0.0f;
+    ids_.clear();
+    freqs_.clear();
+    block_max_freqs_.clear();
+    delta_ids_.clear();
+    delta_freqs_.clear();
+    delta_max_freq_ = 0.0f;
+}
+
+size_t PostingList::size() const {
+    return ids_.size() + delta_ids_.size();
+}
+
+bool PostingList::empty() const {
+    return ids_.empty() && delta_ids_.empty();
+}
+
+float PostingList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+size_t PostingList::GetMemoryUsage() const {
+    return (ids_.capacity() + delta_ids_.capacity()) * sizeof(int)
+        + (freqs_.capacity() + delta_freqs_.capacity() + block_max_freqs_.capacity()) * sizeof(float);
+}
+
+// Inserting into the delta buffer shifts its tail, so it may grow with the
+// square root of the main arrays: merges stay cheap on average and inserts stay short
+size_t PostingList::GetMaxDeltaSize() const {
+    constexpr size_t min_delta_size = 64;
+    return std::max(min_delta_size, static_cast<size_t>(std::sqrt(static_cast<double>(ids_.size()))));
+}
+
+// Recomputes maxima of the blocks starting from the one holding first_pos:
+// an insertion or removal there shifts all the postings after it
+void PostingList::UpdateBlockMaxFreqs(size_t first_pos) {
+    const size_t first_block = first_pos / block_size_;
+    block_max_freqs_.resize((ids_.size() + block_size_ - 1) / block_size_);
+    for (size_t block = first_block; block < block_max_freqs_.size(); ++block) {
+        const auto block_begin = freqs_.begin() + block * block_size_;
+        const auto block_end = freqs_.begin() + std::min(freqs_.size(), (block + 1) * block_size_);
+        block_max_freqs_[block] = *std::max_element(block_begin, block_end);
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "posting_codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Postings of a single word: document ids sorted in ascending order, stored
+// contiguously next to their term frequencies.
+// Documents added out of id order go to a small sorted delta buffer which is
+// merged into the main arrays once it grows too large.
+// Every block of block_size_ postings keeps its maximal term frequency, so
+// queries can skip blocks which cannot score high enough.
+class PostingList {
+public:
+    // Walks the postings in ascending id order, merging the main arrays with the delta buffer.
+    // Packed postings are decoded one block at a time, only for the blocks the cursor stops in
+    class Cursor {
+    public:
+        explicit Cursor(const PostingList& postings);
+
+        explicit Cursor(const PackedPostings& postings);
+
+        bool IsEnd() const;
+
+        int GetDocumentId() const;
+
+        float GetTermFreq() const;
+
+        void Next();
+
+        // Moves to the first posting with id not less than document_id
+        void SkipTo(int document_id);
+
+        // Postings from the current one up to GetBlockLastDocumentId() have
+        // term frequencies not greater than GetBlockMaxTermFreq()
+        int GetBlockLastDocumentId() const;
+
+        float GetBlockMaxTermFreq() const;
+
+        // Upper bound of the term frequencies in the whole list
+        float GetMaxTermFreq() const;
+
+        // Appends one id per block_size_ postings of the list, the last of
+        // each full block, whatever the cursor position
+        void AddBlockLastDocumentIds(std::vector<int>& ids) const;
+
+    private:
+        const int* ids_ = nullptr;
+        const float* freqs_ = nullptr;
+        const float* block_max_freqs_ = nullptr;
+        size_t size_ = 0;
+        const int* delta_ids_ = nullptr;
+        const float* delta_freqs_ = nullptr;
+        size_t delta_size_ = 0;
+        float delta_max_freq_ = 0.0f;
+        float max_term_freq_ = 0.0f;
+        size_t pos_ = 0;
+        size_t delta_pos_ = 0;
+        bool in_delta_ = false;
+
+        // Packed postings replace the main arrays
+        bool is_packed_ = false;
+        PackedPostings packed_;
+        std::array<int, POSTING_BLOCK_SIZE> block_ids_;
+        // Frequencies are decoded only for the blocks where they are read
+        mutable std::array<float, POSTING_BLOCK_SIZE> block_freqs_;
+        mutable bool has_block_freqs_ = false;
+
+        void Settle();
+
+        void LoadBlock(size_t block);
+
+        void LoadBlockFreqs() const;
+    };
+
+    PostingList() = default;
+
+    // Copies the postings from the cursor position to the end
+    explicit PostingList(Cursor postings);
+
+    void Add(int document_id, float term_freq);
+
+    void Merge();
+
+    // Removes all the postings but keeps the allocated memory
+    void Clear();
+
+    size_t size() const;
+
+    bool empty() const;
+
+    // Upper bound of the term frequencies in the list; it is not lowered on removal
+    float GetMaxTermFreq() const;
+
+    // Heap usage in bytes
+    size_t GetMemoryUsage() const;
+
+private:
+    const static size_t block_size_ = POSTING_BLOCK_SIZE;
+
+    float max_term_freq_ = 0.0f;
+    std::vector<int> ids_;
+    std::vector<float> freqs_;
+    std::vector<float> block_max_freqs_;
+    std::vector<int> delta_ids_;
+    std::vector<float> delta_freqs_;
+    float delta_max_freq_ = 0.0f;
+
+    size_t GetMaxDeltaSize() const;
+
+    void UpdateBlockMaxFreqs(size_t first_pos);
+};
@@ -3,17 +3,32 @@
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
     std::vector<std::vector<Document>> result(queries.size());
     std::transform(std::execution::par, queries.begin(), queries.end(), result.begin(),
-        [&search_server](const std::string& query) {return search_server.FindTopDocuments(query);});
+        [&search_server](const std::string& query) {
+            thread_local SearchServer::QueryContext context;
+            return search_server.FindTopDocuments(context, query);
+        });
     return result;
 }
 
 std::vector <Document>  ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
-    std::vector<std::vector<Document>> process_queries = ProcessQueries(search_server, queries);
     std::vector<Document> result;
-    for (const auto& process_query : process_queries) {
-        for (const Document& doc : process_query) {
-            result.insert(result.end(), doc);
-        }
-    }
+    ProcessQueryChunks(search_server, queries,
+        [&result](const std::vector<std::vector<Document>>& chunk_results, size_t count) {
+            size_t size = result.size();
+            for (size_t i = 0; i < count; ++i) {
+                size += chunk_results[i].size();
+            }
+            // Growing at least twofold keeps the copies linear in the result size
+            if (size > result.capacity()) {
+                result.reserve(std::max(size, 2 * result.capacity()));
+            }
+            for (size_t i = 0; i < count; ++i) {
+                result.insert(result.end(), chunk_results[i].begin(), chunk_results[i].end());
+            }
+        });
     return result;
+}
+
+std::vector<std::vector<Document>> ProcessQueriesBatched(const SearchServer& search_server, const std::vector<std::string>& queries) {
+    return search_server.FindTopDocumentsBatch(std::execution::par, queries);
 }
\ No newline at end of file
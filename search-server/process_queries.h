@@ -10,4 +10,48 @@
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
-std::vector <Document>  ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
+// Queries are run in parallel chunks of this size, so memory does not grow
+// with the number of queries
+const size_t PROCESS_QUERIES_CHUNK_SIZE = 1024;
+
+std::vector <Document>  ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Passes the documents found for all the queries to sink in query order,
+// each chunk of queries as soon as it is done
+template <typename DocumentSink>
+void ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries, DocumentSink sink);
+
+// Calls chunk_sink(results, count) for every chunk of queries in order, with
+// the documents of its count queries in the first elements of results
+template <typename ChunkSink>
+void ProcessQueryChunks(const SearchServer& search_server, const std::vector<std::string>& queries, ChunkSink chunk_sink);
+
+// Runs the queries in a few batches; each batch walks the postings of a word
+// once for all of its queries
+std::vector<std::vector<Document>> ProcessQueriesBatched(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+template <typename DocumentSink>
+void ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries, DocumentSink sink) {
+    ProcessQueryChunks(search_server, queries,
+        [&sink](const std::vector<std::vector<Document>>& chunk_results, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                for (const Document& document : chunk_results[i]) {
+                    sink(document);
+                }
+            }
+        });
+}
+
+template <typename ChunkSink>
+void ProcessQueryChunks(const SearchServer& search_server, const std::vector<std::string>& queries, ChunkSink chunk_sink) {
+    std::vector<std::vector<Document>> chunk_results(std::min(queries.size(), PROCESS_QUERIES_CHUNK_SIZE));
+    for (size_t first = 0; first < queries.size(); first += PROCESS_QUERIES_CHUNK_SIZE) {
+        const size_t last = std::min(queries.size(), first + PROCESS_QUERIES_CHUNK_SIZE);
+        std::transform(std::execution::par, queries.begin() + first, queries.begin() + last, chunk_results.begin(),
+            [&search_server](const std::string& query) {
+                thread_local SearchServer::QueryContext context;
+                return search_server.FindTopDocuments(context, query);
+            });
+        chunk_sink(chunk_results, last - first);
+    }
+}
\ No newline at end of file
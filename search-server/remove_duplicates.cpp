@@ -1,28 +1,39 @@
 #include "remove_duplicates.h"
 
+#include <algorithm>
+#include <execution>
 #include <iostream>
-void RemoveDuplicates(SearchServer& search_server) {
-    SearchServer& inner = search_server;
-    std::vector<int> ids_to_delete;
-    std::set<std::string_view> doc_words;
-    std::map<std::set<std::string_view>, int> scanning_list;                  //    -  ,   - id
+#include <unordered_map>
+#include <vector>
+
+// Fingerprints are computed in parallel; only documents with equal
+// fingerprints have their words compared. The first document of every word
+// set in insertion order is kept
+void RemoveDuplicates(SearchServer& search_server, bool compact) {
+    const std::vector<int> document_ids(search_server.begin(), search_server.end());
+    std::vector<DocumentFingerprint> fingerprints(document_ids.size());
+    std::transform(std::execution::par, document_ids.begin(), document_ids.end(), fingerprints.begin(),
+        [&search_server](int document_id) {return search_server.GetDocumentFingerprint(document_id); });
 
-    for (const int doc_id : inner) {                                     //    id_word_freqs
-        for (auto [word, _] : inner.GetWordFrequencies(doc_id)) {        //           = id
-            doc_words.insert(word);
-        }                                                                //  -        
-        if (scanning_list.count(doc_words) == 0) {                   //      -   
-            scanning_list[doc_words] = doc_id;                       //        
+    std::unordered_multimap<DocumentFingerprint, int, DocumentFingerprintHasher> kept_document_ids;
+    kept_document_ids.reserve(document_ids.size());
+    std::vector<int> ids_to_delete;
+    for (size_t i = 0; i < document_ids.size(); ++i) {
+        const auto [first, last] = kept_document_ids.equal_range(fingerprints[i]);
+        if (std::any_of(first, last, [&](const auto& kept) {
+            return search_server.HaveSameWords(kept.second, document_ids[i]); })) {
+            ids_to_delete.push_back(document_ids[i]);
         }
         else {
-            ids_to_delete.emplace_back(doc_id);                      //      id   id  
+            kept_document_ids.emplace(fingerprints[i], document_ids[i]);
         }
-        doc_words.clear();                                           //     
-
     }
-    for (auto id : ids_to_delete) {
+    for (int id : ids_to_delete) {
         using namespace std::literals;
-        std::cout << "Found duplicate document id "s << id << std::endl;
-        inner.RemoveDocument(id);
+        std::cout << "Found duplicate document id "s << id << '\n';
+    }
+    search_server.RemoveDocuments(ids_to_delete);
+    if (compact) {
+        search_server.Compact();                                         //    
     }
-}
\ No newline at end of file
+}
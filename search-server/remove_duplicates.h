@@ -2,4 +2,8 @@
 
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+// Removes every document with the same set of words as an earlier one.
+// Postings of the removed documents stay in sealed segments until they are
+// merged; with compact set, SearchServer::Compact() rewrites the segments
+// holding them right away, which takes time proportional to those segments
+void RemoveDuplicates(SearchServer& search_server, bool compact = false);
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+bool ResultCacheKey::operator==(const ResultCacheKey& other) const {
+    return plus_words == other.plus_words && minus_words == other.minus_words && status == other.status
+        && max_result_count == other.max_result_count;
+}
+
+size_t ResultCacheKeyHasher::operator()(const ResultCacheKey& key) const {
+    size_t hash = std::hash<size_t>{}(key.max_result_count) * 37 + static_cast<size_t>(key.status);
+    for (uint32_t term_id : key.plus_words) {
+        hash = hash * 1000003 + term_id;
+    }
+    hash = hash * 1000003 + key.plus_words.size();
+    for (uint32_t term_id : key.minus_words) {
+        hash = hash * 1000003 + term_id;
+    }
+    return hash;
+}
+
+ResultCache::ResultCache(size_t capacity)
+    : bucket_capacity_(std::max<size_t>(1, (capacity + bucket_count_ - 1) / bucket_count_))
+    , buckets_(bucket_count_)
+{
+}
+
+bool ResultCache::Find(const ResultCacheKey& key, uint64_t generation, std::vector<Document>& documents) {
+    Bucket& bucket = GetBucket(key);
+    std::lock_guard guard(bucket.mutex);
+    const auto entry = bucket.entries.find(key);
+    if (entry == bucket.entries.end() || entry->second.generation != generation) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    bucket.recent_keys.splice(bucket.recent_keys.begin(), bucket.recent_keys, entry->second.recent_position);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    documents.assign(entry->second.documents.begin(), entry->second.documents.end());
+    return true;
+}
+
+void ResultCache::Insert(const ResultCacheKey& key, uint64_t generation, const std::vector<Document>& documents) {
+    Bucket& bucket = GetBucket(key);
+    std::lock_guard guard(bucket.mutex);
+    auto [entry, is_new] = bucket.entries.try_emplace(key);
+    if (is_new) {
+        bucket.recent_keys.push_front(&entry->first);
+        entry->second.recent_position = bucket.recent_keys.begin();
+    }
+    else {
+        bucket.recent_keys.splice(bucket.recent_keys.begin(), bucket.recent_keys, entry->second.recent_position);
+    }
+    // Another thread could have put the result of a newer generation while this one was computed
+    if (is_new || entry->second.generation <= generation) {
+        entry->second.generation = generation;
+        entry->second.documents = documents;
+    }
+    if (bucket.entries.size() > bucket_capacity_) {
+        bucket.entries.erase(*bucket.recent_keys.back());
+        bucket.recent_keys.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ResultCacheStats ResultCache::GetStats() const {
+    return { hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed),
+        evictions_.load(std::memory_order_relaxed) };
+}
+
+ResultCache::Bucket& ResultCache::GetBucket(const ResultCacheKey& key) {
+    return buckets_[ResultCacheKeyHasher{}(key) % bucket_count_];
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "document.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// A query reduced to what its results depend on: the sorted distinct ids of
+// its words, the status of the documents and the number of results
+struct ResultCacheKey {
+    std::vector<uint32_t> plus_words;
+    std::vector<uint32_t> minus_words;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    size_t max_result_count = 0;
+
+    bool operator==(const ResultCacheKey& other) const;
+};
+
+struct ResultCacheKeyHasher {
+    size_t operator()(const ResultCacheKey& key) const;
+};
+
+struct ResultCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Bounded LRU cache of query results which can be used from many threads.
+// Keys are spread over buckets with their own lock and LRU order, like in
+// ConcurrentMap. A result is only returned for the index generation it was
+// computed for; older ones are replaced as the queries come again.
+// It is not built on ConcurrentMap: a hit moves its key to the front of the
+// LRU list and an insert evicts the back of it, so the list has to change
+// under the same lock as the entries. With the list apart, a Visit under a
+// shared lock would still need an exclusive one for the order
+class ResultCache {
+public:
+    explicit ResultCache(size_t capacity);
+
+    // Copies the cached result into the memory of documents
+    bool Find(const ResultCacheKey& key, uint64_t generation, std::vector<Document>& documents);
+
+    // Allocates for a new key: a map node with copies of the key and the
+    // documents, and a node of the LRU list
+    void Insert(const ResultCacheKey& key, uint64_t generation, const std::vector<Document>& documents);
+
+    ResultCacheStats GetStats() const;
+
+private:
+    struct Entry {
+        uint64_t generation = 0;
+        std::vector<Document> documents;
+        std::list<const ResultCacheKey*>::iterator recent_position;
+    };
+
+    struct Bucket {
+        std::mutex mutex;
+        std::unordered_map<ResultCacheKey, Entry, ResultCacheKeyHasher> entries;
+        std::list<const ResultCacheKey*> recent_keys;   // the most recently used first
+    };
+
+    const static size_t bucket_count_ = 16;
+
+    size_t bucket_capacity_;
+    std::vector<Bucket> buckets_;
+    std::atomic<uint64_t> hits_{ 0 };
+    std::atomic<uint64_t> misses_{ 0 };
+    std::atomic<uint64_t> evictions_{ 0 };
+
+    Bucket& GetBucket(const ResultCacheKey& key);
+};
@@ -1,5 +1,47 @@
 #include "search_server.h"
 #include "log_duration.h"
+#include "mapped_file.h"
+
+namespace {
+
+// Returns the first set bit from position on, or bits.size() * 64 if there is none
+size_t FindNextBit(const std::vector<uint64_t>& bits, size_t position) {
+    size_t word = position / 64;
+    if (word >= bits.size()) {
+        return bits.size() * 64;
+    }
+    uint64_t value = bits[word] & (~uint64_t{ 0 } << position % 64);
+    while (value == 0) {
+        if (++word == bits.size()) {
+            return bits.size() * 64;
+        }
+        value = bits[word];
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return word * 64 + __builtin_ctzll(value);
+#else
+    size_t bit = 0;
+    while ((value >> bit & 1) == 0) {
+        ++bit;
+    }
+    return word * 64 + bit;
+#endif
+}
+
+// Finalizer of SplitMix64: every input bit affects every output bit
+uint64_t MixBits(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+// A count differing from the one its log was taken for by max_staleness of
+// it or more needs a new log; with 0 any difference does
+bool IsTooStale(uint32_t count, uint32_t logged_count, double max_staleness) {
+    return count != logged_count && std::abs(static_cast<double>(count) - logged_count) >= max_staleness * logged_count;
+}
+
+} // namespace
 
 SearchServer::SearchServer(const std::string& stop_words_text)
     : SearchServer(
@@ -16,70 +58,348 @@ void SearchServer::AddDocument(int document_id, std::string_view document, Docum
     if ((document_id < 0) || (documents_.count(document_id) > 0)) {
         throw std::invalid_argument("Invalid document_id");
     }
-    documents_from_request.insert({ document_id, std::string(document) });
 
-    auto words = SplitIntoWordsNoStop(documents_from_request.at(document_id)); //   
-    const double inv_word_count = 1.0 / words.size();                                            //
-    for (std::string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_word_freqs_[document_id][word] += inv_word_count;
+    auto words = SplitIntoTermIdsNoStop(document);                             //   
+    auto word_freqs = ComputeTermFreqs(std::move(words));
+    std::vector<std::pair<int, int>> duplicates;
+    if (duplicate_policy_ != DuplicatePolicy::ALLOW && !RegisterFingerprint(document_id, word_freqs, duplicates)) {
+        ReportDuplicates(duplicates);
+        return;
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
-    document_ids_.push_back(document_id);
+    ++generation_;
+    // Postings of the removed document with this id are still in the mutable segment
+    if (mutable_removed_document_ids_.count(document_id) > 0) {
+        SealMutableSegment();
+    }
+    for (const auto& [term_id, term_freq] : word_freqs) {
+        AddTermPosting(term_id, document_id, static_cast<float>(term_freq));
+    }
+    id_word_freqs_.emplace(document_id, std::move(word_freqs));
+    AddDocumentData(document_id, ComputeAverageRating(ratings), status);
+    if (mutable_document_ids_.size() >= max_mutable_document_count_) {
+        SealMutableSegment();
+    }
+    ReportDuplicates(duplicates);
 }
 
-void SearchServer::RemoveDocument(int document_id) {
+void SearchServer::AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents) {
+    using namespace std::literals;
+    if (documents.empty()) {
+        return;
+    }
+    // Documents are indexed in id order, so postings are only appended
+    std::vector<const NewDocument*> sorted_documents(documents.size());
+    std::transform(documents.begin(), documents.end(), sorted_documents.begin(),
+        [](const NewDocument& document) {return &document; });
+    std::sort(sorted_documents.begin(), sorted_documents.end(),
+        [](const NewDocument* lhs, const NewDocument* rhs) {return lhs->id < rhs->id; });
+    for (size_t i = 0; i < sorted_documents.size(); ++i) {
+        const int document_id = sorted_documents[i]->id;
+        if ((document_id < 0) || (documents_.count(document_id) > 0)
+            || (i > 0 && sorted_documents[i - 1]->id == document_id)) {
+            throw std::invalid_argument("Invalid document_id");
+        }
+    }
 
-    auto pos = find(document_ids_.begin(), document_ids_.end(), document_id);  //      id
-    document_ids_.erase(pos);                                                  //   
+    const size_t part_count = std::min<size_t>(documents.size(),
+        std::max(1u, std::thread::hardware_concurrency()) * 4);
+    std::vector<PartialIndex> partial_indexes(part_count);
+    std::vector<size_t> part_indexes(part_count);
+    std::iota(part_indexes.begin(), part_indexes.end(), 0);
+    std::for_each(std::execution::par, part_indexes.begin(), part_indexes.end(), [&](size_t part_index) {
+        PartialIndex& partial_index = partial_indexes[part_index];
+        const size_t first = documents.size() * part_index / part_count;
+        const size_t last = documents.size() * (part_index + 1) / part_count;
+        // An exception escaping a parallel algorithm terminates the program
+        try {
+            for (size_t i = first; i < last; ++i) {
+                AddToPartialIndex(*sorted_documents[i], partial_index);
+            }
+        }
+        catch (...) {
+            partial_index.error = std::current_exception();
+        }
+        });
+    for (const PartialIndex& partial_index : partial_indexes) {
+        if (partial_index.error != nullptr) {
+            std::rethrow_exception(partial_index.error);
+        }
+    }
 
+    if (std::any_of(documents.begin(), documents.end(), [&](const NewDocument& document) {
+        return mutable_removed_document_ids_.count(document.id) > 0; })) {
+        SealMutableSegment();
+    }
+    std::vector<std::pair<int, int>> duplicates;
+    const size_t indexed_document_count = id_word_freqs_.size();
+    for (size_t part_index = 0; part_index < part_count; ++part_index) {
+        const auto first = sorted_documents.begin() + documents.size() * part_index / part_count;
+        const auto last = sorted_documents.begin() + documents.size() * (part_index + 1) / part_count;
+        MergePartialIndex(partial_indexes[part_index], { first, last }, duplicates);
+    }
+    // Nothing changes when every document is a rejected duplicate
+    if (id_word_freqs_.size() > indexed_document_count) {
+        ++generation_;
+    }
+    for (const NewDocument& document : documents) {
+        // Rejected duplicates have no forward index entry
+        if (id_word_freqs_.count(document.id) > 0) {
+            AddDocumentData(document.id, ComputeAverageRating(document.ratings), document.status);
+        }
+    }
+    if (mutable_document_ids_.size() >= max_mutable_document_count_) {
+        SealMutableSegment();
+    }
+    ReportDuplicates(duplicates);
+}
 
-    for (auto [key_word, _] : id_word_freqs_.at(document_id)) {                //  -  
+void SearchServer::AddToPartialIndex(const NewDocument& document, PartialIndex& partial_index) const {
+    using namespace std::literals;
+    if (const auto invalid_word = tokenizer_.SplitIntoWordsNoStop(document.text, partial_index.text_words)) {
+        throw std::invalid_argument("Word "s + std::string(*invalid_word) + " is invalid"s);
+    }
+    std::vector<uint32_t> word_ids;
+    word_ids.reserve(partial_index.text_words.size());
+    for (std::string_view word : partial_index.text_words) {
+        const auto [it, inserted] = partial_index.word_ids.emplace(word, static_cast<uint32_t>(partial_index.words.size()));
+        if (inserted) {
+            partial_index.words.push_back(word);
+            partial_index.postings.emplace_back();
+        }
+        word_ids.push_back(it->second);
+    }
+    auto word_freqs = ComputeTermFreqs(std::move(word_ids));
+    for (const auto& [word_id, term_freq] : word_freqs) {
+        partial_index.postings[word_id].emplace_back(document.id, static_cast<float>(term_freq));
+    }
+    partial_index.document_word_freqs.push_back(std::move(word_freqs));
+}
 
-        word_to_document_freqs_.at(std::string(key_word)).erase(document_id);               //   id    
-        if (word_to_document_freqs_.at(std::string(key_word)).empty()) {                    //      
-            word_to_document_freqs_.erase(std::string(key_word));                           //   
+// documents are the ones the partial index was built from, in the same order.
+// A word new to the dictionary is added with the first document which has it.
+// Such a document is no duplicate, so a rejected one adds no words; words are
+// still added in the order of their first use, as they were before
+void SearchServer::MergePartialIndex(PartialIndex& partial_index, const std::vector<const NewDocument*>& documents,
+    std::vector<std::pair<int, int>>& duplicates) {
+    const uint32_t new_term_id = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> term_ids(partial_index.words.size());
+    for (size_t word_id = 0; word_id < partial_index.words.size(); ++word_id) {
+        term_ids[word_id] = dictionary_.FindTerm(partial_index.words[word_id]).value_or(new_term_id);
+    }
+    std::unordered_set<int> rejected_document_ids;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        auto& word_freqs = partial_index.document_word_freqs[i];
+        for (auto& [word_id, _] : word_freqs) {
+            if (term_ids[word_id] == new_term_id) {
+                term_ids[word_id] = AddTerm(partial_index.words[word_id]);
+            }
+            word_id = term_ids[word_id];
+        }
+        std::sort(word_freqs.begin(), word_freqs.end());
+        if (duplicate_policy_ != DuplicatePolicy::ALLOW
+            && !RegisterFingerprint(documents[i]->id, word_freqs, duplicates)) {
+            rejected_document_ids.insert(documents[i]->id);
+            continue;
+        }
+        id_word_freqs_.emplace(documents[i]->id, std::move(word_freqs));
+    }
+    for (size_t word_id = 0; word_id < partial_index.words.size(); ++word_id) {
+        for (const auto& [document_id, term_freq] : partial_index.postings[word_id]) {
+            if (rejected_document_ids.empty() || rejected_document_ids.count(document_id) == 0) {
+                AddTermPosting(term_ids[word_id], document_id, term_freq);
+            }
         }
     }
+}
 
-    id_word_freqs_.erase(document_id);                                         //   
-    documents_.erase(document_id);                                             //   
+void SearchServer::RemoveDocument(int document_id) {
+    RemoveDocumentData(document_id);
+    if (2 * removed_position_count_ > document_ids_.size()) {
+        RemoveDocumentIdHoles();
+    }
 }
 
 void  SearchServer::RemoveDocument(std::execution::sequenced_policy seq, int document_id) {
     SearchServer::RemoveDocument(document_id);
 }
 
+// A tombstone only touches a counter per word, there is nothing to split between threads
 void SearchServer::RemoveDocument(std::execution::parallel_policy par, int document_id) {
+    SearchServer::RemoveDocument(document_id);
+}
+
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    std::vector<int> sorted_document_ids = document_ids;
+    std::sort(sorted_document_ids.begin(), sorted_document_ids.end());
+    if (std::adjacent_find(sorted_document_ids.begin(), sorted_document_ids.end()) != sorted_document_ids.end()
+        || std::any_of(sorted_document_ids.begin(), sorted_document_ids.end(),
+            [&](int document_id) {return documents_.count(document_id) == 0; })) {
+        throw std::out_of_range("out_of_range");
+    }
+    for (int document_id : sorted_document_ids) {
+        RemoveDocumentData(document_id);
+    }
+    if (2 * removed_position_count_ > document_ids_.size()) {
+        RemoveDocumentIdHoles();
+    }
+}
+
+size_t SearchServer::Compact(size_t max_document_count) {
+    return CompactSegments(std::execution::seq, max_document_count);
+}
+
+size_t SearchServer::Compact(std::execution::sequenced_policy seq, size_t max_document_count) {
+    return SearchServer::Compact(max_document_count);
+}
+
+size_t SearchServer::Compact(std::execution::parallel_policy par, size_t max_document_count) {
+    return CompactSegments(std::execution::par, max_document_count);
+}
+
+// Sealing drops the removed documents of the mutable segment, then sealed
+// segments are rewritten one by one, each of them on its own thread for par
+template <typename ExecutionPolicy>
+size_t SearchServer::CompactSegments(const ExecutionPolicy& policy, size_t max_document_count) {
+    size_t document_count = max_document_count;
+    const size_t mutable_removed_count = mutable_document_ids_.size() - mutable_live_document_count_;
+    if (document_count > 0 && mutable_removed_count > 0) {
+        document_count -= std::min(document_count, mutable_removed_count);
+        SealMutableSegment();
+    }
+
+    std::vector<size_t> segment_indexes;
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (segments_[i].live_document_count < segments_[i].segment->GetDocumentCount()) {
+            segment_indexes.push_back(i);
+        }
+    }
+    const auto removed_count = [&](size_t i) {
+        return segments_[i].segment->GetDocumentCount() - segments_[i].live_document_count;
+    };
+    std::sort(segment_indexes.begin(), segment_indexes.end(), [&](size_t lhs, size_t rhs) {
+        return removed_count(lhs) > removed_count(rhs); });
+    size_t chosen_count = 0;
+    for (; chosen_count < segment_indexes.size() && document_count > 0; ++chosen_count) {
+        document_count -= std::min(document_count, removed_count(segment_indexes[chosen_count]));
+    }
+    segment_indexes.resize(chosen_count);
+
+    std::vector<std::shared_ptr<const IndexSegment>> rewritten_segments(segment_indexes.size());
+    std::transform(policy, segment_indexes.begin(), segment_indexes.end(), rewritten_segments.begin(),
+        [&](size_t segment_index) {return MergeSegments({ segment_index }); });
+    // Replacing a segment moves only the ones after it
+    std::vector<size_t> order(segment_indexes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return segment_indexes[lhs] > segment_indexes[rhs]; });
+    for (size_t i : order) {
+        ReplaceSegments({ segment_indexes[i] }, std::move(rewritten_segments[i]));
+    }
+    ApplyMergePolicy();
+    return GetRemovedDocumentCount();
+}
+
+// Words missing from the dictionary are not part of the key: they match
+// nothing until a document brings them, and that changes the generation
+template <typename Search>
+std::vector<Document> SearchServer::FindCachedDocuments(const Query& query, DocumentStatus status,
+    size_t max_result_count, Search search) const {
+    const ResultCacheKey key{ query.plus_words, query.minus_words, status, max_result_count };
+    std::vector<Document> documents;
+    if (result_cache_->Find(key, generation_, documents)) {
+        return documents;
+    }
+    documents = search();
+    result_cache_->Insert(key, generation_, documents);
+    return documents;
+}
 
-    std::vector<std::string_view> strings_to_del(id_word_freqs_.at(document_id).size());
-    std::transform(std::execution::par, id_word_freqs_.at(document_id).begin(), id_word_freqs_.at(document_id).end(), strings_to_del.begin(),
-        [](const auto& pa) {return pa.first; });
-    std::for_each(std::execution::par, strings_to_del.begin(), strings_to_del.end(),
-        [&](const std::string_view string_to_del) {word_to_document_freqs_.at(string_to_del).erase(document_id); });
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query,
+    DocumentStatus status, size_t max_result_count, QueryEvaluation evaluation) const {
+    const DocumentFilter filter{ status };
+    if (!result_cache_) {
+        return SearchServer::FindTopDocuments(context, raw_query, filter, max_result_count, evaluation);
+    }
+    ParseUniqueQuery(raw_query, context.words_, context.query_);
+    ResultCacheKey& key = context.cache_key_;
+    key.plus_words.assign(context.query_.plus_words.begin(), context.query_.plus_words.end());
+    key.minus_words.assign(context.query_.minus_words.begin(), context.query_.minus_words.end());
+    key.status = status;
+    key.max_result_count = max_result_count;
+    if (!result_cache_->Find(key, generation_, context.documents_)) {
+        ComputeQueryInverseDocumentFreqs(context.query_);
+        context.top_documents_.Reset(max_result_count);
+        FindAllDocuments(context.query_, filter, AnyDocument{}, evaluation, context.query_postings_,
+            context.cursor_buffers_, context.top_documents_);
+        context.top_documents_.Extract(context.documents_);
+        result_cache_->Insert(key, generation_, context.documents_);
+    }
+    return context.documents_;
+}
+
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query,
+    const DocumentFilter& filter, size_t max_result_count, QueryEvaluation evaluation) const {
+    ParseUniqueQuery(raw_query, context.words_, context.query_);
+    ComputeQueryInverseDocumentFreqs(context.query_);
+    context.top_documents_.Reset(max_result_count);
+    FindAllDocuments(context.query_, filter, AnyDocument{}, evaluation, context.query_postings_,
+        context.cursor_buffers_, context.top_documents_);
+    context.top_documents_.Extract(context.documents_);
+    return context.documents_;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    auto query = ParseUniqueQuery(raw_query);
+    ComputeQueryInverseDocumentFreqs(query);
+    return FindAllDocuments(query, filter, AnyDocument{}, max_result_count, evaluation);
+}
 
-    id_word_freqs_.erase(document_id);                                         //   
-    documents_.erase(document_id);                                             //   
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query,
+    const DocumentFilter& filter, size_t max_result_count, QueryEvaluation evaluation) const {
+    auto query = ParseUniqueQuery(raw_query);
+    ComputeQueryInverseDocumentFreqs(query);
+    return FindAllDocuments(par, query, filter, AnyDocument{}, max_result_count, evaluation);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
-     return SearchServer::FindTopDocuments(
-            raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-                return document_status == status;
-            });
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const CorpusStats& corpus_stats,
+    const DocumentFilter& filter, size_t max_result_count, QueryEvaluation evaluation) const {
+    auto query = ParseUniqueQuery(raw_query);
+    for (uint32_t term_id : query.plus_words) {
+        query.plus_word_inverse_document_freqs.push_back(log(corpus_stats.document_count * 1.0
+            / corpus_stats.word_document_counts.at(dictionary_.GetTerm(term_id))));
     }
+    return FindAllDocuments(query, filter, AnyDocument{}, max_result_count, evaluation);
+}
 
-std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    const DocumentFilter filter{ status };
+    if (!result_cache_) {
+        return SearchServer::FindTopDocuments(raw_query, filter, max_result_count, evaluation);
+    }
+    auto query = ParseUniqueQuery(raw_query);
+    return FindCachedDocuments(query, status, max_result_count, [&] {
+        ComputeQueryInverseDocumentFreqs(query);
+        return FindAllDocuments(query, filter, AnyDocument{}, max_result_count, evaluation);
         });
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(par,
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    return SearchServer::FindTopDocuments(raw_query, status, max_result_count, evaluation);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    const DocumentFilter filter{ status };
+    if (!result_cache_) {
+        return SearchServer::FindTopDocuments(par, raw_query, filter, max_result_count, evaluation);
+    }
+    auto query = ParseUniqueQuery(raw_query);
+    return FindCachedDocuments(query, status, max_result_count, [&] {
+        ComputeQueryInverseDocumentFreqs(query);
+        return FindAllDocuments(par, query, filter, AnyDocument{}, max_result_count, evaluation);
         });
 }
 
@@ -95,16 +415,256 @@ std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_po
         return SearchServer::FindTopDocuments(par, raw_query, DocumentStatus::ACTUAL);
     }
 
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+    DocumentStatus status, size_t max_result_count) const {
+    const QueryBatch batch = GroupQueries(raw_queries.begin(), raw_queries.end());
+    return FindBatchDocuments(batch, raw_queries.size(), status, max_result_count);
+}
+
+// All the queries are parsed before any batch starts, so an invalid one throws here
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(std::execution::parallel_policy par,
+    const std::vector<std::string>& raw_queries, DocumentStatus status, size_t max_result_count) const {
+    const size_t batch_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+        (raw_queries.size() + min_parallel_batch_size_ - 1) / min_parallel_batch_size_);
+    if (batch_count <= 1) {
+        return FindTopDocumentsBatch(raw_queries, status, max_result_count);
+    }
+    std::vector<size_t> first_queries;
+    std::vector<QueryBatch> batches;
+    for (size_t i = 0; i <= batch_count; ++i) {
+        first_queries.push_back(raw_queries.size() * i / batch_count);
+    }
+    for (size_t i = 0; i < batch_count; ++i) {
+        batches.push_back(GroupQueries(raw_queries.begin() + first_queries[i], raw_queries.begin() + first_queries[i + 1]));
+    }
+    std::vector<std::vector<std::vector<Document>>> batch_results(batch_count);
+    std::vector<size_t> batch_indexes(batch_count);
+    std::iota(batch_indexes.begin(), batch_indexes.end(), 0);
+    std::for_each(std::execution::par, batch_indexes.begin(), batch_indexes.end(), [&](size_t i) {
+        batch_results[i] = FindBatchDocuments(batches[i], first_queries[i + 1] - first_queries[i], status, max_result_count);
+        });
+
+    std::vector<std::vector<Document>> results;
+    results.reserve(raw_queries.size());
+    for (std::vector<std::vector<Document>>& batch_result : batch_results) {
+        std::move(batch_result.begin(), batch_result.end(), std::back_inserter(results));
+    }
+    return results;
+}
+
 int SearchServer::GetDocumentCount() const {
     return static_cast<int>(documents_.size());
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static const std::map<std::string_view, double> res;
-    if (id_word_freqs_.find(document_id) == id_word_freqs_.end()) {
+void SearchServer::AddQueryCorpusStats(std::string_view raw_query, CorpusStats& corpus_stats) const {
+    corpus_stats.document_count += GetDocumentCount();
+    std::unordered_set<std::string_view> plus_words;
+    for (std::string_view word : SplitIntoWords(raw_query)) {
+        const auto query_word = ParseQueryWord(word);
+        if (query_word.is_minus || query_word.is_stop || !plus_words.insert(query_word.data).second) {
+            continue;
+        }
+        uint32_t& document_count = corpus_stats.word_document_counts[query_word.data];
+        if (query_word.term_id) {
+            document_count += terms_[*query_word.term_id].document_count;
+        }
+    }
+}
+
+QueryStats SearchServer::GetQueryStats() const {
+    return { scored_postings_.load(std::memory_order_relaxed), scored_documents_.load(std::memory_order_relaxed) };
+}
+
+void SearchServer::ResetQueryStats() {
+    scored_postings_.store(0, std::memory_order_relaxed);
+    scored_documents_.store(0, std::memory_order_relaxed);
+}
+
+void SearchServer::SetMaxIdfStaleness(double max_staleness) {
+    max_idf_staleness_ = max_staleness;
+    RefreshInverseDocumentFreqs();
+    ++generation_;
+}
+
+void SearchServer::SetResultCacheCapacity(size_t capacity) {
+    result_cache_ = capacity > 0 ? std::make_unique<ResultCache>(capacity) : nullptr;
+}
+
+void SearchServer::SetDuplicatePolicy(DuplicatePolicy policy, DuplicateHandler handler) {
+    duplicate_policy_ = policy;
+    duplicate_handler_ = std::move(handler);
+    document_fingerprints_.clear();
+    if (policy == DuplicatePolicy::ALLOW) {
+        return;
+    }
+    document_fingerprints_.reserve(id_word_freqs_.size());
+    for (const auto& [document_id, word_freqs] : id_word_freqs_) {
+        document_fingerprints_.emplace(ComputeFingerprint(word_freqs), document_id);
+    }
+}
+
+ResultCacheStats SearchServer::GetResultCacheStats() const {
+    return result_cache_ ? result_cache_->GetStats() : ResultCacheStats{};
+}
+
+// std::map nodes are counted with their colour and three links
+MemoryUsage SearchServer::GetMemoryUsage() const {
+    constexpr size_t map_node_overhead = 4 * sizeof(void*);
+    MemoryUsage usage;
+    usage.dictionary = dictionary_.GetMemoryUsage() + terms_.capacity() * sizeof(TermData);
+    for (const TermData& term : terms_) {
+        usage.postings += term.postings.GetMemoryUsage();
+    }
+    for (const SegmentData& segment : segments_) {
+        usage.postings += segment.segment->GetMemoryUsage();
+        const DocumentColumns& columns = segment.columns;
+        usage.documents += columns.ratings.capacity() * sizeof(int)
+            + columns.statuses.capacity() * sizeof(DocumentStatus)
+            + columns.live_bits.capacity() * sizeof(uint64_t) * (1 + document_status_count_);
+    }
+    for (const auto& [_, word_freqs] : id_word_freqs_) {
+        usage.forward_index += map_node_overhead + sizeof(std::pair<int, std::vector<std::pair<uint32_t, double>>>)
+            + word_freqs.capacity() * sizeof(std::pair<uint32_t, double>);
+    }
+    usage.documents += documents_.size() * (map_node_overhead + sizeof(std::pair<int, DocumentData>))
+        + document_ids_.capacity() * sizeof(int)
+        + document_fingerprints_.size() * (sizeof(void*) + sizeof(size_t) + sizeof(std::pair<DocumentFingerprint, int>))
+        + document_fingerprints_.bucket_count() * sizeof(void*);
+    return usage;
+}
+
+// Payload: the terms with their stop word flags, the postings of every term,
+// the documents with their word frequencies and the ids in insertion order
+void SearchServer::SaveSnapshot(const std::string& path) const {
+    SnapshotWriter writer(path);
+    writer.Write(static_cast<uint64_t>(terms_.size()));
+    for (uint32_t term_id = 0; term_id < terms_.size(); ++term_id) {
+        writer.WriteString(dictionary_.GetTerm(term_id));
+        writer.Write(static_cast<uint8_t>(terms_[term_id].is_stop_word));
+    }
+    // All the segments are merged into one, leaving out removed documents,
+    // which LoadSnapshot reads in place
+    const IndexSegment mutable_segment = BuildMutableSegment();
+    std::vector<const IndexSegment*> segments;
+    std::vector<std::vector<int>> removed_document_ids;
+    for (const SegmentData& segment : segments_) {
+        segments.push_back(segment.segment.get());
+        removed_document_ids.push_back(FindRemovedDocuments(*segment.segment, segment.id, segment.live_document_count));
+    }
+    segments.push_back(&mutable_segment);
+    removed_document_ids.push_back(FindRemovedDocuments(mutable_segment, mutable_segment_id_,
+        mutable_live_document_count_));
+    IndexSegment::Merge(segments, removed_document_ids).Save(writer);
+
+    writer.Write(static_cast<uint64_t>(documents_.size()));
+    for (const auto& [document_id, document_data] : documents_) {
+        const auto& word_freqs = id_word_freqs_.at(document_id);
+        writer.Write(static_cast<int32_t>(document_id));
+        writer.Write(static_cast<int32_t>(document_data.rating));
+        writer.Write(static_cast<int32_t>(document_data.status));
+        writer.Write(static_cast<uint64_t>(word_freqs.size()));
+        for (const auto& [term_id, term_freq] : word_freqs) {
+            writer.Write(term_id);
+            writer.Write(term_freq);
+        }
+    }
+
+    const std::vector<int> document_ids(begin(), end());
+    writer.Write(static_cast<uint64_t>(document_ids.size()));
+    writer.WriteArray(document_ids);
+    writer.Finish();
+}
+
+SearchServer SearchServer::LoadSnapshot(const std::string& path) {
+    auto file = std::make_shared<const MappedFile>(path);
+    SnapshotReader reader(file->data(), file->size());
+    return SearchServer(reader, std::move(file));
+}
+
+SearchServer::SearchServer(SnapshotReader& reader, std::shared_ptr<const void> storage) {
+    using namespace std::literals;
+    const size_t term_count = reader.Read<uint64_t>();
+    std::vector<std::string> stop_words;
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        if (AddTerm(reader.ReadString()) != term_id) {
+            throw std::runtime_error("Snapshot has duplicate terms"s);
+        }
+        terms_[term_id].is_stop_word = reader.Read<uint8_t>() != 0;
+        if (terms_[term_id].is_stop_word) {
+            stop_words.emplace_back(dictionary_.GetTerm(static_cast<uint32_t>(term_id)));
+        }
+    }
+    tokenizer_ = Tokenizer(std::move(stop_words));
+    // The postings become one sealed segment whose arrays stay in the snapshot memory
+    auto segment = std::make_shared<const IndexSegment>(IndexSegment::Load(reader, std::move(storage)));
+    const uint64_t segment_id = next_segment_id_++;
+
+    // Documents were written in id order, so every insertion goes to the end of the maps
+    const size_t document_count = reader.Read<uint64_t>();
+    for (size_t i = 0; i < document_count; ++i) {
+        const int document_id = reader.Read<int32_t>();
+        const int rating = reader.Read<int32_t>();
+        const auto status = static_cast<DocumentStatus>(reader.Read<int32_t>());
+        if (static_cast<size_t>(status) >= document_status_count_) {
+            throw std::runtime_error("Snapshot has an invalid document status"s);
+        }
+        std::vector<std::pair<uint32_t, double>> word_freqs(reader.Read<uint64_t>());
+        for (auto& [term_id, term_freq] : word_freqs) {
+            term_id = reader.Read<uint32_t>();
+            term_freq = reader.Read<double>();
+            if (term_id >= term_count) {
+                throw std::runtime_error("Snapshot refers to an unknown term"s);
+            }
+            ++terms_[term_id].document_count;
+        }
+        documents_.emplace_hint(documents_.end(), document_id, DocumentData{ rating, status, 0, segment_id });
+        id_word_freqs_.emplace_hint(id_word_freqs_.end(), document_id, std::move(word_freqs));
+    }
+    const SegmentArray<int>& segment_document_ids = segment->GetDocumentIds();
+    if (!std::equal(segment_document_ids.begin(), segment_document_ids.end(), documents_.begin(), documents_.end(),
+        [](int document_id, const auto& document) {return document_id == document.first; })) {
+        throw std::runtime_error("Snapshot postings and documents differ"s);
+    }
+
+    reader.ReadArray(document_ids_, reader.Read<uint64_t>());
+    for (size_t position = 0; position < document_ids_.size(); ++position) {
+        const auto document = documents_.find(document_ids_[position]);
+        if (document == documents_.end()) {
+            throw std::runtime_error("Snapshot refers to an unknown document"s);
+        }
+        document->second.position = position;
+    }
+    if (!reader.IsEnd()) {
+        throw std::runtime_error("Snapshot has trailing data"s);
+    }
+    if (!documents_.empty()) {
+        DocumentColumns columns = BuildDocumentColumns(*segment, segment_id);
+        segments_.push_back({ std::move(segment), segment_id, documents_.size(), std::move(columns) });
+    }
+    RefreshInverseDocumentFreqs();
+}
+
+std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
+    std::map<std::string_view, double> res;
+    const auto word_freqs = id_word_freqs_.find(document_id);
+    if (word_freqs == id_word_freqs_.end() || documents_.count(document_id) == 0) {
         return res;
     }
-    return id_word_freqs_.at(document_id);
+    for (const auto& [term_id, term_freq] : word_freqs->second) {
+        res.emplace(dictionary_.GetTerm(term_id), term_freq);
+    }
+    return res;
+}
+
+DocumentFingerprint SearchServer::GetDocumentFingerprint(int document_id) const {
+    if (documents_.count(document_id) == 0) {
+        throw std::out_of_range("out_of_range");
+    }
+    return ComputeFingerprint(id_word_freqs_.at(document_id));
+}
+
+bool SearchServer::HaveSameWords(int lhs_document_id, int rhs_document_id) const {
+    return HaveSameTerms(id_word_freqs_.at(lhs_document_id), id_word_freqs_.at(rhs_document_id));
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query,
@@ -113,32 +673,10 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
         using namespace std::literals;
         throw std::invalid_argument("Word "s + std::string{ raw_query } + " is invalid"s);
     }
-    if (std::count(document_ids_.begin(), document_ids_.end(), document_id) == 0) {
+    if (documents_.count(document_id) == 0) {
         throw std::out_of_range("out_of_range");
     }
-
-    auto query = ParseQuery(raw_query);
-    std::sort(query.plus_words.begin(), query.plus_words.end());
-    query.plus_words.erase(std::unique(query.plus_words.begin(), query.plus_words.end()), query.plus_words.end());
-
-    std::sort(query.minus_words.begin(), query.minus_words.end());
-    query.minus_words.erase(std::unique(query.minus_words.begin(), query.minus_words.end()),
-        query.minus_words.end());
-
-    if (std::any_of(query.minus_words.begin(), query.minus_words.end(),
-        [&](std::string_view minus_word) {return word_to_document_freqs_.at(minus_word).count(document_id); })) {
-        return { std::vector<std::basic_string_view<char>>{}, documents_.at(document_id).status };
-    }
-    std::vector<std::string_view> matched_words(query.plus_words.size());
-    matched_words.resize(query.plus_words.size());
-    auto it = std::copy_if(query.plus_words.begin(), query.plus_words.end(), matched_words.begin(),
-        [&](std::string_view plus_word) {return word_to_document_freqs_.at(plus_word).count(document_id); });
-    
-    std::sort(matched_words.begin(), it);
-    matched_words.erase(std::unique(matched_words.begin(), it),
-        matched_words.end());
-
-    return { matched_words, documents_.at(document_id).status };
+    return MatchQuery(ParseUniqueQuery(raw_query), document_id);
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::sequenced_policy seq,
@@ -148,31 +686,70 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::parallel_policy par,
     std::string_view raw_query, int document_id) const {
-    // Check if the document_id is valid
-    if ((document_id < 0) || (documents_.count(document_id) <= 0)) {
-        throw std::out_of_range("Invalid document_id");
-    }
-
-    auto query = ParseQuery(raw_query);
+    return SearchServer::MatchDocument(raw_query, document_id);
+}
 
-    if (std::any_of(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
-        [&](std::string_view minus_word) {return word_to_document_freqs_.at(minus_word).count(document_id); })) {
-        return { std::vector<std::basic_string_view<char>>{}, documents_.at(document_id).status };
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    std::string_view raw_query, const std::vector<int>& document_ids) const {
+    if (!IsValidWord(raw_query)) {
+        using namespace std::literals;
+        throw std::invalid_argument("Word "s + std::string{ raw_query } + " is invalid"s);
     }
-    std::vector<std::string_view> matched_words = {};
-    matched_words.resize(query.plus_words.size());
-    auto it = std::copy_if(std::execution::par, query.plus_words.begin(), query.plus_words.end(), matched_words.begin(),
-        [&](std::string_view plus_word) {return word_to_document_freqs_.at(plus_word).count(document_id); });
-    
-    std::sort(std::execution::par, matched_words.begin(), it);
-    matched_words.erase(std::unique(std::execution::par, matched_words.begin(), it),
-        matched_words.end());
+    const auto query = ParseUniqueQuery(raw_query);
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> matches;
+    matches.reserve(document_ids.size());
+    for (int document_id : document_ids) {
+        matches.push_back(MatchQuery(query, document_id));
+    }
+    return matches;
+}
 
-    return { matched_words, documents_.at(document_id).status };
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    std::execution::parallel_policy par, std::string_view raw_query, const std::vector<int>& document_ids) const {
+    if (!IsValidWord(raw_query)) {
+        using namespace std::literals;
+        throw std::invalid_argument("Word "s + std::string{ raw_query } + " is invalid"s);
+    }
+    // MatchQuery throwing inside the parallel algorithm would terminate the process
+    if (std::any_of(document_ids.begin(), document_ids.end(),
+        [&](int document_id) {return documents_.count(document_id) == 0; })) {
+        throw std::out_of_range("out_of_range");
+    }
+    const auto query = ParseUniqueQuery(raw_query);
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> matches(document_ids.size());
+    std::transform(std::execution::par, document_ids.begin(), document_ids.end(), matches.begin(),
+        [&](int document_id) {return MatchQuery(query, document_id); });
+    return matches;
 }
 
-bool SearchServer::IsStopWord(std::string_view word) const {
-    return stop_words_.count(word) > 0;
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchQuery(const Query& query,
+    int document_id) const {
+    const auto document = documents_.find(document_id);
+    if (document == documents_.end()) {
+        throw std::out_of_range("out_of_range");
+    }
+    const DocumentStatus status = document->second.status;
+    const auto& word_freqs = id_word_freqs_.at(document_id);
+    size_t position = 0;
+    for (uint32_t term_id : query.minus_words) {
+        position = FindTerm(word_freqs, position, term_id);
+        if (position < word_freqs.size() && word_freqs[position].first == term_id) {
+            return { std::vector<std::string_view>{}, status };
+        }
+    }
+    std::vector<std::string_view> matched_words;
+    position = 0;
+    for (uint32_t term_id : query.plus_words) {
+        position = FindTerm(word_freqs, position, term_id);
+        if (position == word_freqs.size()) {
+            break;
+        }
+        if (word_freqs[position].first == term_id) {
+            matched_words.push_back(dictionary_.GetTerm(term_id));
+        }
+    }
+    std::sort(matched_words.begin(), matched_words.end());
+    return { matched_words, status };
 }
 
 bool SearchServer::IsValidWord(std::string_view word) {
@@ -182,18 +759,320 @@ bool SearchServer::IsValidWord(std::string_view word) {
         });
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
+uint32_t SearchServer::AddTerm(std::string_view word) {
+    const uint32_t term_id = dictionary_.AddTerm(word);
+    if (term_id == terms_.size()) {
+        terms_.emplace_back();
+    }
+    return term_id;
+}
+
+std::vector<std::pair<uint32_t, double>> SearchServer::ComputeTermFreqs(std::vector<uint32_t> term_ids) {
+    const double inv_word_count = 1.0 / term_ids.size();
+    std::sort(term_ids.begin(), term_ids.end());
+    std::vector<std::pair<uint32_t, double>> term_freqs;
+    for (uint32_t term_id : term_ids) {
+        if (term_freqs.empty() || term_freqs.back().first != term_id) {
+            term_freqs.emplace_back(term_id, 0.0);
+        }
+        term_freqs.back().second += inv_word_count;
+    }
+    return term_freqs;
+}
+
+// The hashes of the words are summed, so the order of the words does not
+// matter. Two halves mixed from different seeds make a collision of two word
+// sets about as likely as one of a 128-bit hash
+DocumentFingerprint SearchServer::ComputeFingerprint(const std::vector<std::pair<uint32_t, double>>& word_freqs) {
+    DocumentFingerprint fingerprint;
+    for (const auto& [term_id, _] : word_freqs) {
+        fingerprint.low += MixBits(term_id);
+        fingerprint.high += MixBits(term_id ^ 0x9E3779B97F4A7C15ull);
+    }
+    return fingerprint;
+}
+
+bool SearchServer::HaveSameTerms(const std::vector<std::pair<uint32_t, double>>& lhs_word_freqs,
+    const std::vector<std::pair<uint32_t, double>>& rhs_word_freqs) {
+    return std::equal(lhs_word_freqs.begin(), lhs_word_freqs.end(), rhs_word_freqs.begin(), rhs_word_freqs.end(),
+        [](const auto& lhs, const auto& rhs) {return lhs.first == rhs.first; });
+}
+
+std::optional<int> SearchServer::FindDuplicate(const DocumentFingerprint& fingerprint,
+    const std::vector<std::pair<uint32_t, double>>& word_freqs) const {
+    // equal_range would walk all the copies REPORT lets in, while the first one
+    // almost always matches
+    for (auto it = document_fingerprints_.find(fingerprint);
+        it != document_fingerprints_.end() && it->first == fingerprint; ++it) {
+        if (HaveSameTerms(id_word_freqs_.at(it->second), word_freqs)) {
+            return it->second;
+        }
+    }
+    return std::nullopt;
+}
+
+bool SearchServer::RegisterFingerprint(int document_id, const std::vector<std::pair<uint32_t, double>>& word_freqs,
+    std::vector<std::pair<int, int>>& duplicates) {
+    const DocumentFingerprint fingerprint = ComputeFingerprint(word_freqs);
+    if (const auto original_document_id = FindDuplicate(fingerprint, word_freqs)) {
+        duplicates.emplace_back(document_id, *original_document_id);
+        if (duplicate_policy_ == DuplicatePolicy::REJECT) {
+            return false;
+        }
+    }
+    document_fingerprints_.emplace(fingerprint, document_id);
+    return true;
+}
+
+void SearchServer::ReportDuplicates(const std::vector<std::pair<int, int>>& duplicates) const {
+    if (!duplicate_handler_) {
+        return;
+    }
+    for (const auto& [document_id, original_document_id] : duplicates) {
+        duplicate_handler_(document_id, original_document_id);
+    }
+}
+
+std::vector<uint32_t> SearchServer::SplitIntoTermIdsNoStop(std::string_view text) {
     using namespace std::literals;
     std::vector<std::string_view> words;
-    for (std::string_view word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
+    if (const auto invalid_word = tokenizer_.SplitIntoWordsNoStop(text, words)) {
+        throw std::invalid_argument("Word "s + std::string(*invalid_word) + " is invalid"s);
+    }
+    std::vector<uint32_t> term_ids;
+    term_ids.reserve(words.size());
+    for (std::string_view word : words) {
+        const std::optional<uint32_t> term_id = dictionary_.FindTerm(word);
+        term_ids.push_back(term_id ? *term_id : AddTerm(word));
+    }
+    return term_ids;
+}
+
+void SearchServer::AddTermPosting(uint32_t term_id, int document_id, float term_freq) {
+    TermData& term = terms_[term_id];
+    if (term.postings.empty()) {
+        mutable_term_ids_.push_back(term_id);
+    }
+    term.postings.Add(document_id, term_freq);
+    ++term.document_count;
+    UpdateInverseDocumentFreq(term);
+}
+
+void SearchServer::AddDocumentData(int document_id, int rating, DocumentStatus status) {
+    documents_.emplace(document_id, DocumentData{ rating, status, document_ids_.size(), mutable_segment_id_ });
+    document_ids_.push_back(document_id);
+    mutable_document_ids_.push_back(document_id);
+    ++mutable_live_document_count_;
+    UpdateDocumentCountLog();
+}
+
+void SearchServer::RemoveDocumentData(int document_id) {
+    const DocumentData& document_data = documents_.at(document_id);
+    ++generation_;
+    document_ids_[document_data.position] = removed_document_id_;
+    ++removed_position_count_;
+    if (document_data.segment_id == mutable_segment_id_) {
+        --mutable_live_document_count_;
+        mutable_removed_document_ids_.insert(document_id);
+    }
+    else {
+        SegmentData& segment = *std::find_if(segments_.begin(), segments_.end(), [&](const SegmentData& segment) {
+            return segment.id == document_data.segment_id; });
+        --segment.live_document_count;
+        const SegmentArray<int>& segment_document_ids = segment.segment->GetDocumentIds();
+        const size_t position = std::lower_bound(segment_document_ids.begin(), segment_document_ids.end(), document_id)
+            - segment_document_ids.begin();
+        const uint64_t mask = ~(uint64_t{ 1 } << position % 64);
+        segment.columns.live_bits[position / 64] &= mask;
+        segment.columns.status_bits[static_cast<size_t>(document_data.status)][position / 64] &= mask;
+    }
+    const auto& word_freqs = id_word_freqs_.at(document_id);
+    for (const auto& [term_id, _] : word_freqs) {
+        --terms_[term_id].document_count;
+        UpdateInverseDocumentFreq(terms_[term_id]);
+    }
+    if (duplicate_policy_ != DuplicatePolicy::ALLOW) {
+        const auto [first, last] = document_fingerprints_.equal_range(ComputeFingerprint(word_freqs));
+        document_fingerprints_.erase(std::find_if(first, last,
+            [document_id](const auto& fingerprint) {return fingerprint.second == document_id; }));
+    }
+    id_word_freqs_.erase(document_id);
+    documents_.erase(document_id);
+    UpdateDocumentCountLog();
+}
+
+void SearchServer::RemoveDocumentIdHoles() {
+    document_ids_.erase(std::remove(document_ids_.begin(), document_ids_.end(), removed_document_id_),
+        document_ids_.end());
+    for (size_t position = 0; position < document_ids_.size(); ++position) {
+        documents_.at(document_ids_[position]).position = position;
+    }
+    removed_position_count_ = 0;
+}
+
+IndexSegment SearchServer::BuildMutableSegment() const {
+    std::vector<uint32_t> term_ids = mutable_term_ids_;
+    std::sort(term_ids.begin(), term_ids.end());
+    std::vector<float> freq_table;
+    for (uint32_t term_id : term_ids) {
+        for (PostingList::Cursor cursor(terms_[term_id].postings); !cursor.IsEnd(); cursor.Next()) {
+            freq_table.push_back(cursor.GetTermFreq());
         }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
+    }
+    std::sort(freq_table.begin(), freq_table.end());
+    freq_table.erase(std::unique(freq_table.begin(), freq_table.end()), freq_table.end());
+    std::vector<int> document_ids = mutable_document_ids_;
+    std::sort(document_ids.begin(), document_ids.end());
+    IndexSegment segment(std::move(document_ids), std::move(freq_table));
+    for (uint32_t term_id : term_ids) {
+        segment.AppendTerm(term_id, PostingList::Cursor(terms_[term_id].postings));
+    }
+    segment.ShrinkToFit();
+    return segment;
+}
+
+void SearchServer::SealMutableSegment() {
+    if (mutable_document_ids_.empty()) {
+        return;
+    }
+    // The mutable lists keep their capacity, so the next segment does not grow them again
+    auto segment = std::make_shared<const IndexSegment>(BuildMutableSegment());
+    DocumentColumns columns = BuildDocumentColumns(*segment, mutable_segment_id_);
+    SegmentData sealed{ std::move(segment), mutable_segment_id_, mutable_live_document_count_, std::move(columns) };
+    for (uint32_t term_id : mutable_term_ids_) {
+        terms_[term_id].postings.Clear();
+    }
+    mutable_term_ids_.clear();
+    mutable_document_ids_.clear();
+    mutable_live_document_count_ = 0;
+    mutable_removed_document_ids_.clear();
+    mutable_segment_id_ = next_segment_id_++;
+
+    const bool has_removed_documents = sealed.live_document_count < sealed.segment->GetDocumentCount();
+    segments_.push_back(std::move(sealed));
+    if (has_removed_documents) {
+        ReplaceSegments({ segments_.size() - 1 }, MergeSegments({ segments_.size() - 1 }));
+    }
+    ApplyMergePolicy();
+}
+
+// Tier k holds segments with at least max_mutable_document_count_ * segment_merge_factor_^k
+// live documents, starting from tier 0 for the freshly sealed ones
+size_t SearchServer::GetSegmentTier(size_t document_count) {
+    size_t tier = 0;
+    for (size_t size = max_mutable_document_count_ * segment_merge_factor_; document_count >= size;
+        size *= segment_merge_factor_) {
+        ++tier;
+    }
+    return tier;
+}
+
+// Tiered merging: once a tier collects segment_merge_factor_ segments they are
+// merged into one segment of a higher tier, so every posting is rewritten only
+// a logarithmic number of times
+void SearchServer::ApplyMergePolicy() {
+    while (true) {
+        std::map<size_t, std::vector<size_t>> tiers;
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            tiers[GetSegmentTier(segments_[i].live_document_count)].push_back(i);
+        }
+        const auto full_tier = std::find_if(tiers.begin(), tiers.end(), [](const auto& tier) {
+            return tier.second.size() >= segment_merge_factor_; });
+        if (full_tier == tiers.end()) {
+            return;
+        }
+        ReplaceSegments(full_tier->second, MergeSegments(full_tier->second));
+    }
+}
+
+std::vector<int> SearchServer::FindRemovedDocuments(const IndexSegment& segment, uint64_t segment_id,
+    size_t live_document_count) const {
+    std::vector<int> removed_document_ids;
+    if (live_document_count == segment.GetDocumentCount()) {
+        return removed_document_ids;
+    }
+    for (int document_id : segment.GetDocumentIds()) {
+        const auto document = documents_.find(document_id);
+        if (document == documents_.end() || document->second.segment_id != segment_id) {
+            removed_document_ids.push_back(document_id);
         }
     }
-    return words;
+    return removed_document_ids;
+}
+
+std::shared_ptr<const IndexSegment> SearchServer::MergeSegments(const std::vector<size_t>& segment_indexes) const {
+    std::vector<const IndexSegment*> segments;
+    std::vector<std::vector<int>> removed_document_ids;
+    for (size_t segment_index : segment_indexes) {
+        const SegmentData& segment = segments_[segment_index];
+        segments.push_back(segment.segment.get());
+        removed_document_ids.push_back(FindRemovedDocuments(*segment.segment, segment.id, segment.live_document_count));
+    }
+    return std::make_shared<const IndexSegment>(IndexSegment::Merge(segments, removed_document_ids));
+}
+
+void SearchServer::ReplaceSegments(std::vector<size_t> segment_indexes, std::shared_ptr<const IndexSegment> merged) {
+    const uint64_t segment_id = next_segment_id_++;
+    for (int document_id : merged->GetDocumentIds()) {
+        documents_.at(document_id).segment_id = segment_id;
+    }
+    std::sort(segment_indexes.rbegin(), segment_indexes.rend());
+    for (size_t segment_index : segment_indexes) {
+        segments_.erase(segments_.begin() + segment_index);
+    }
+    if (merged->GetDocumentCount() > 0) {
+        const size_t document_count = merged->GetDocumentCount();
+        DocumentColumns columns = BuildDocumentColumns(*merged, segment_id);
+        segments_.push_back({ std::move(merged), segment_id, document_count, std::move(columns) });
+    }
+}
+
+SearchServer::DocumentColumns SearchServer::BuildDocumentColumns(const IndexSegment& segment,
+    uint64_t segment_id) const {
+    const SegmentArray<int>& document_ids = segment.GetDocumentIds();
+    const size_t word_count = (document_ids.size() + 63) / 64;
+    DocumentColumns columns;
+    columns.ratings.resize(document_ids.size());
+    columns.statuses.resize(document_ids.size());
+    columns.live_bits.resize(word_count);
+    for (std::vector<uint64_t>& bits : columns.status_bits) {
+        bits.resize(word_count);
+    }
+    for (size_t position = 0; position < document_ids.size(); ++position) {
+        const auto document = documents_.find(document_ids[position]);
+        if (document == documents_.end() || document->second.segment_id != segment_id) {
+            continue;
+        }
+        const DocumentData& document_data = document->second;
+        const uint64_t bit = uint64_t{ 1 } << position % 64;
+        columns.ratings[position] = document_data.rating;
+        columns.statuses[position] = document_data.status;
+        columns.live_bits[position / 64] |= bit;
+        columns.status_bits[static_cast<size_t>(document_data.status)][position / 64] |= bit;
+        columns.min_rating = std::min(columns.min_rating, document_data.rating);
+        columns.max_rating = std::max(columns.max_rating, document_data.rating);
+    }
+    return columns;
+}
+
+size_t SearchServer::GetRemovedDocumentCount() const {
+    size_t removed_document_count = mutable_document_ids_.size() - mutable_live_document_count_;
+    for (const SegmentData& segment : segments_) {
+        removed_document_count += segment.segment->GetDocumentCount() - segment.live_document_count;
+    }
+    return removed_document_count;
+}
+
+size_t SearchServer::FindTerm(const std::vector<std::pair<uint32_t, double>>& word_freqs, size_t first,
+    uint32_t term_id) {
+    size_t last = first;
+    for (size_t step = 1; last < word_freqs.size() && word_freqs[last].first < term_id; step *= 2) {
+        first = last + 1;
+        last += step;
+    }
+    return std::lower_bound(word_freqs.begin() + first, word_freqs.begin() + std::min(last + 1, word_freqs.size()),
+        term_id, [](const std::pair<uint32_t, double>& word_freq, uint32_t id) {return word_freq.first < id; })
+        - word_freqs.begin();
 }
 
 int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
@@ -220,36 +1099,473 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
         throw std::invalid_argument("Query word "s + std::string(text) + " is invalid");
     }
 
-    return { word, is_minus, IsStopWord(word) };
+    const auto term_id = dictionary_.FindTerm(word);
+    return { word, is_minus, term_id && terms_[*term_id].is_stop_word, term_id };
 }
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
-    Query result;
-    for (std::string_view word : SplitIntoWords(text)) {
+void SearchServer::ParseQuery(std::string_view text, std::vector<std::string_view>& words, Query& query) const {
+    query.plus_words.clear();
+    query.minus_words.clear();
+    query.plus_word_inverse_document_freqs.clear();
+    SplitIntoWords(text, words);
+    for (std::string_view word : words) {
         const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
+        if (!query_word.is_stop && query_word.term_id) {
             if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
+                query.minus_words.push_back(*query_word.term_id);
             }
             else {
-                result.plus_words.push_back(query_word.data);
+                query.plus_words.push_back(*query_word.term_id);
             }
         }
     }
-    return result;
+}
+
+SearchServer::Query SearchServer::ParseUniqueQuery(std::string_view text) const {
+    Query query;
+    std::vector<std::string_view> words;
+    ParseUniqueQuery(text, words, query);
+    return query;
+}
+
+void SearchServer::ParseUniqueQuery(std::string_view text, std::vector<std::string_view>& words, Query& query) const {
+    ParseQuery(text, words, query);
+    std::sort(query.plus_words.begin(), query.plus_words.end());
+    query.plus_words.erase(std::unique(query.plus_words.begin(), query.plus_words.end()), query.plus_words.end());
+
+    std::sort(query.minus_words.begin(), query.minus_words.end());
+    query.minus_words.erase(std::unique(query.minus_words.begin(), query.minus_words.end()),
+        query.minus_words.end());
 }
 
 // Existence required
-double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+double SearchServer::ComputeWordInverseDocumentFreq(uint32_t term_id) const {
+    return log_document_count_ - terms_[term_id].log_document_count;
+}
+
+void SearchServer::ComputeQueryInverseDocumentFreqs(Query& query) const {
+    query.plus_word_inverse_document_freqs.clear();
+    for (uint32_t term_id : query.plus_words) {
+        query.plus_word_inverse_document_freqs.push_back(
+            terms_[term_id].document_count > 0 ? ComputeWordInverseDocumentFreq(term_id) : 0.0);
+    }
+}
+
+void SearchServer::UpdateInverseDocumentFreq(TermData& term) {
+    if (term.document_count > 0 && IsTooStale(term.document_count, term.idf_document_count, max_idf_staleness_)) {
+        term.idf_document_count = term.document_count;
+        term.log_document_count = log(term.document_count * 1.0);
+    }
+}
+
+void SearchServer::UpdateDocumentCountLog() {
+    const int document_count = GetDocumentCount();
+    if (document_count > 0 && IsTooStale(document_count, idf_document_count_, max_idf_staleness_)) {
+        idf_document_count_ = document_count;
+        log_document_count_ = log(document_count * 1.0);
+    }
+}
+
+void SearchServer::RefreshInverseDocumentFreqs() {
+    for (TermData& term : terms_) {
+        term.idf_document_count = 0;
+        UpdateInverseDocumentFreq(term);
+    }
+    idf_document_count_ = 0;
+    UpdateDocumentCountLog();
+}
+
+void SearchServer::FindQueryPostings(const Query& query, const SegmentData* segment,
+    QueryPostings& query_postings) const {
+    const auto find_postings = [&](uint32_t term_id) -> std::optional<PostingList::Cursor> {
+        if (segment != nullptr) {
+            return segment->segment->FindPostings(term_id);
+        }
+        const PostingList& postings = terms_[term_id].postings;
+        if (postings.empty()) {
+            return std::nullopt;
+        }
+        return PostingList::Cursor(postings);
+    };
+    query_postings.segment = segment;
+    query_postings.plus_postings.clear();
+    query_postings.minus_postings.clear();
+    for (size_t i = 0; i < query.plus_words.size(); ++i) {
+        const uint32_t term_id = query.plus_words[i];
+        const auto postings = find_postings(term_id);
+        if (postings && terms_[term_id].document_count > 0) {
+            query_postings.plus_postings.push_back({ *postings, query.plus_word_inverse_document_freqs[i] });
+        }
+    }
+    for (uint32_t term_id : query.minus_words) {
+        const auto postings = find_postings(term_id);
+        if (postings) {
+            query_postings.minus_postings.push_back(*postings);
+        }
+    }
+}
+
+std::vector<SearchServer::QueryPostings> SearchServer::FindSegmentQueryPostings(const Query& query) const {
+    std::vector<QueryPostings> segment_query_postings;
+    for (const SegmentData& segment : segments_) {
+        QueryPostings query_postings;
+        FindQueryPostings(query, &segment, query_postings);
+        if (!query_postings.plus_postings.empty()) {
+            segment_query_postings.push_back(std::move(query_postings));
+        }
+    }
+    QueryPostings query_postings;
+    FindQueryPostings(query, nullptr, query_postings);
+    if (!query_postings.plus_postings.empty()) {
+        segment_query_postings.push_back(std::move(query_postings));
+    }
+    return segment_query_postings;
+}
+
+// Range bounds are quantiles of the last ids of the posting blocks, each
+// block standing for the same number of postings
+std::vector<int> SearchServer::SplitByPostings(const std::vector<QueryPostings>& segment_query_postings,
+    int last_document_id, size_t range_count) {
+    std::vector<int> block_last_ids;
+    for (const QueryPostings& query_postings : segment_query_postings) {
+        for (const ScoredPostings& plus_postings : query_postings.plus_postings) {
+            plus_postings.postings.AddBlockLastDocumentIds(block_last_ids);
+        }
+    }
+    std::sort(block_last_ids.begin(), block_last_ids.end());
+    std::vector<int> range_last_ids;
+    for (size_t i = 1; i < range_count; ++i) {
+        const size_t pos = block_last_ids.size() * i / range_count;
+        if (pos == block_last_ids.size() || block_last_ids[pos] >= last_document_id) {
+            break;
+        }
+        if (range_last_ids.empty() || range_last_ids.back() < block_last_ids[pos]) {
+            range_last_ids.push_back(block_last_ids[pos]);
+        }
+    }
+    range_last_ids.push_back(last_document_id);
+    return range_last_ids;
 }
 
+// The rating range of the segment tells if ratings need to be checked at all
+SearchServer::SegmentDocumentFilter::SegmentDocumentFilter(const SearchServer& server, const SegmentData* segment,
+    const DocumentFilter& filter)
+    : server_(server)
+    , segment_(segment)
+    , filter_(filter)
+{
+    if (segment_ == nullptr) {
+        return;
+    }
+    const DocumentColumns& columns = segment_->columns;
+    bits_ = filter_.status ? &columns.status_bits[static_cast<size_t>(*filter_.status)] : &columns.live_bits;
+    is_empty_ = filter_.min_rating > columns.max_rating || filter_.max_rating < columns.min_rating;
+    checks_rating_ = filter_.min_rating > columns.min_rating || filter_.max_rating < columns.max_rating;
+}
 
-std::vector<int>::const_iterator SearchServer::begin() {
-    return document_ids_.begin();
+int64_t SearchServer::SegmentDocumentFilter::SkipRejected(int document_id) {
+    if (segment_ == nullptr) {
+        return document_id;
+    }
+    const SegmentArray<int>& document_ids = segment_->segment->GetDocumentIds();
+    if (!is_empty_) {
+        for (size_t position = FindNextBit(*bits_, FindPosition(document_id)); position < document_ids.size();
+            position = FindNextBit(*bits_, position + 1)) {
+            if (HasAcceptedRating(position)) {
+                position_ = position;
+                return document_ids[position];
+            }
+        }
+    }
+    return int64_t{ std::numeric_limits<int>::max() } + 1;
 }
 
+bool SearchServer::SegmentDocumentFilter::Accept(int document_id, DocumentStatus& status, int& rating) {
+    if (segment_ == nullptr) {
+        const auto document = server_.documents_.find(document_id);
+        if (document == server_.documents_.end() || document->second.segment_id != server_.mutable_segment_id_) {
+            return false;
+        }
+        status = document->second.status;
+        rating = document->second.rating;
+        return (!filter_.status || status == *filter_.status) && rating >= filter_.min_rating
+            && rating <= filter_.max_rating;
+    }
+    const size_t position = FindPosition(document_id);
+    if (is_empty_ || ((*bits_)[position / 64] >> position % 64 & 1) == 0 || !HasAcceptedRating(position)) {
+        return false;
+    }
+    status = segment_->columns.statuses[position];
+    rating = segment_->columns.ratings[position];
+    return true;
+}
 
-std::vector<int>::const_iterator SearchServer::end() {
-    return document_ids_.end();
+// Asked ids are close to each other, so the search gallops from the last position
+size_t SearchServer::SegmentDocumentFilter::FindPosition(int document_id) {
+    const SegmentArray<int>& document_ids = segment_->segment->GetDocumentIds();
+    size_t first = position_;
+    size_t last = position_;
+    for (size_t step = 1; last < document_ids.size() && document_ids[last] < document_id; step *= 2) {
+        first = last + 1;
+        last += step;
+    }
+    position_ = std::lower_bound(document_ids.begin() + first, document_ids.begin() + std::min(last + 1, document_ids.size()),
+        document_id) - document_ids.begin();
+    return position_;
+}
+
+bool SearchServer::SegmentDocumentFilter::HasAcceptedRating(size_t position) const {
+    if (!checks_rating_) {
+        return true;
+    }
+    const int rating = segment_->columns.ratings[position];
+    return rating >= filter_.min_rating && rating <= filter_.max_rating;
+}
+
+void SearchServer::OpenPlusCursors(const QueryPostings& query_postings, int first_document_id,
+    std::vector<PostingList::Cursor>& cursors) {
+    cursors.clear();
+    for (const auto& [postings, _] : query_postings.plus_postings) {
+        cursors.push_back(postings);
+        cursors.back().SkipTo(first_document_id);
+    }
+}
+
+void SearchServer::OpenMinusCursors(const QueryPostings& query_postings, int first_document_id,
+    std::vector<PostingList::Cursor>& cursors) {
+    cursors.clear();
+    for (const PostingList::Cursor& postings : query_postings.minus_postings) {
+        cursors.push_back(postings);
+        cursors.back().SkipTo(first_document_id);
+    }
+}
+
+// Documents must be checked in ascending id order
+bool SearchServer::IsExcluded(std::vector<PostingList::Cursor>& minus_cursors, int document_id) {
+    return std::any_of(minus_cursors.begin(), minus_cursors.end(), [document_id](PostingList::Cursor& cursor) {
+        cursor.SkipTo(document_id);
+        return !cursor.IsEnd() && cursor.GetDocumentId() == document_id;
+        });
+}
+
+void SearchServer::AddQueryStats(uint64_t scored_postings, uint64_t scored_documents) const {
+    scored_postings_.fetch_add(scored_postings, std::memory_order_relaxed);
+    scored_documents_.fetch_add(scored_documents, std::memory_order_relaxed);
+}
+
+// Words which are in no live document are left without plus queries: like in
+// FindTopDocuments they cannot add to relevance
+SearchServer::QueryBatch SearchServer::GroupQueries(std::vector<std::string>::const_iterator first_query,
+    std::vector<std::string>::const_iterator last_query) const {
+    std::vector<std::pair<uint32_t, uint32_t>> plus_words;      // term id and query index
+    std::vector<std::pair<uint32_t, uint32_t>> minus_words;
+    uint32_t query_index = 0;
+    for (auto it = first_query; it != last_query; ++it, ++query_index) {
+        const Query query = ParseUniqueQuery(*it);
+        for (uint32_t term_id : query.plus_words) {
+            if (terms_[term_id].document_count > 0) {
+                plus_words.emplace_back(term_id, query_index);
+            }
+        }
+        for (uint32_t term_id : query.minus_words) {
+            minus_words.emplace_back(term_id, query_index);
+        }
+    }
+    std::sort(plus_words.begin(), plus_words.end());
+    std::sort(minus_words.begin(), minus_words.end());
+
+    QueryBatch batch;
+    auto plus_word = plus_words.begin();
+    auto minus_word = minus_words.begin();
+    while (plus_word != plus_words.end() || minus_word != minus_words.end()) {
+        const uint32_t term_id = minus_word == minus_words.end()
+            || (plus_word != plus_words.end() && plus_word->first < minus_word->first)
+            ? plus_word->first : minus_word->first;
+        batch.term_ids.push_back(term_id);
+        batch.inverse_document_freqs.push_back(0.0);
+        batch.plus_queries.emplace_back();
+        batch.minus_queries.emplace_back();
+        if (plus_word != plus_words.end() && plus_word->first == term_id) {
+            batch.inverse_document_freqs.back() = ComputeWordInverseDocumentFreq(term_id);
+        }
+        for (; plus_word != plus_words.end() && plus_word->first == term_id; ++plus_word) {
+            batch.plus_queries.back().push_back(plus_word->second);
+        }
+        for (; minus_word != minus_words.end() && minus_word->first == term_id; ++minus_word) {
+            batch.minus_queries.back().push_back(minus_word->second);
+        }
+    }
+    return batch;
+}
+
+std::vector<std::vector<Document>> SearchServer::FindBatchDocuments(const QueryBatch& batch, size_t query_count,
+    DocumentStatus status, size_t max_result_count) const {
+    BatchScores scores;
+    scores.relevances.resize(query_count);
+    scores.relevance_stamps.resize(query_count);
+    scores.exclusion_stamps.resize(query_count);
+    std::vector<TopDocumentsCollector> top_documents(query_count, TopDocumentsCollector(max_result_count));
+    for (const SegmentData& segment : segments_) {
+        FindSegmentBatchDocuments(batch, &segment, status, scores, top_documents);
+    }
+    FindSegmentBatchDocuments(batch, nullptr, status, scores, top_documents);
+
+    std::vector<std::vector<Document>> results;
+    results.reserve(query_count);
+    for (TopDocumentsCollector& query_top_documents : top_documents) {
+        results.push_back(query_top_documents.Extract());
+    }
+    return results;
+}
+
+// Postings of all the words are read a window of ids at a time and grouped by
+// document, so every document is looked up once for the whole batch. The
+// postings of a document stay in ascending word order, so each query sums
+// its relevance in the same order as FindTopDocuments
+void SearchServer::FindSegmentBatchDocuments(const QueryBatch& batch, const SegmentData* segment,
+    DocumentStatus status, BatchScores& scores, std::vector<TopDocumentsCollector>& top_documents) const {
+    SegmentDocumentFilter document_filter(*this, segment, DocumentFilter{ status });
+    std::vector<std::pair<uint32_t, PostingList::Cursor>> cursors;      // with the index of the word in the batch
+    for (uint32_t i = 0; i < batch.term_ids.size(); ++i) {
+        const uint32_t term_id = batch.term_ids[i];
+        if (segment != nullptr) {
+            if (const auto postings = segment->segment->FindPostings(term_id)) {
+                cursors.emplace_back(i, *postings);
+            }
+        }
+        else if (!terms_[term_id].postings.empty()) {
+            cursors.emplace_back(i, PostingList::Cursor(terms_[term_id].postings));
+        }
+    }
+    uint64_t scored_postings = 0;
+    uint64_t scored_documents = 0;
+    scores.window_offsets.resize(batch_window_size_ + 1);
+
+    while (true) {
+        int64_t first_document_id = std::numeric_limits<int64_t>::max();
+        for (const auto& [_, cursor] : cursors) {
+            if (!cursor.IsEnd()) {
+                first_document_id = std::min<int64_t>(first_document_id, cursor.GetDocumentId());
+            }
+        }
+        if (first_document_id == std::numeric_limits<int64_t>::max()) {
+            break;
+        }
+        const int64_t end_document_id = first_document_id + static_cast<int64_t>(batch_window_size_);
+        scores.window_postings.clear();
+        for (auto& [term_index, cursor] : cursors) {
+            const bool is_plus = !batch.plus_queries[term_index].empty();
+            for (; !cursor.IsEnd() && cursor.GetDocumentId() < end_document_id; cursor.Next()) {
+                scores.window_postings.push_back({ static_cast<uint32_t>(cursor.GetDocumentId() - first_document_id),
+                    { term_index, is_plus ? cursor.GetTermFreq() : 0.0f } });
+            }
+        }
+
+        // A counting sort pays for the whole window, so sparse windows are sorted by comparison
+        auto& sorted_postings = scores.sorted_postings;
+        if (scores.window_postings.size() * 8 < batch_window_size_) {
+            sorted_postings = scores.window_postings;
+            std::stable_sort(sorted_postings.begin(), sorted_postings.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+                });
+        }
+        else {
+            std::fill(scores.window_offsets.begin(), scores.window_offsets.end(), 0);
+            for (const auto& [offset, _] : scores.window_postings) {
+                ++scores.window_offsets[offset + 1];
+            }
+            std::partial_sum(scores.window_offsets.begin(), scores.window_offsets.end(), scores.window_offsets.begin());
+            sorted_postings.resize(scores.window_postings.size());
+            for (const auto& posting : scores.window_postings) {
+                sorted_postings[scores.window_offsets[posting.first]++] = posting;
+            }
+        }
+
+        for (size_t first = 0; first < sorted_postings.size();) {
+            const uint32_t offset = sorted_postings[first].first;
+            const uint64_t stamp = ++scores.stamp;
+            scores.scored_queries.clear();
+            size_t last = first;
+            for (; last < sorted_postings.size() && sorted_postings[last].first == offset; ++last) {
+                const auto [term_index, term_freq] = sorted_postings[last].second;
+                for (uint32_t query_index : batch.minus_queries[term_index]) {
+                    scores.exclusion_stamps[query_index] = stamp;
+                }
+                for (uint32_t query_index : batch.plus_queries[term_index]) {
+                    if (scores.relevance_stamps[query_index] != stamp) {
+                        scores.relevance_stamps[query_index] = stamp;
+                        scores.relevances[query_index] = 0.0;
+                        scores.scored_queries.push_back(query_index);
+                    }
+                    scores.relevances[query_index] += term_freq * batch.inverse_document_freqs[term_index];
+                    ++scored_postings;
+                }
+            }
+            first = last;
+            if (scores.scored_queries.empty()) {
+                continue;
+            }
+            scored_documents += scores.scored_queries.size();
+
+            const int document_id = static_cast<int>(first_document_id + offset);
+            DocumentStatus document_status;
+            int rating;
+            if (!document_filter.Accept(document_id, document_status, rating)) {
+                continue;
+            }
+            for (uint32_t query_index : scores.scored_queries) {
+                if (scores.exclusion_stamps[query_index] != stamp) {
+                    top_documents[query_index].Add({ document_id, scores.relevances[query_index], rating });
+                }
+            }
+        }
+    }
+    AddQueryStats(scored_postings, scored_documents);
+}
+
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    return { document_ids_.begin(), document_ids_.end() };
+}
+
+
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    return { document_ids_.end(), document_ids_.end() };
+}
+
+SearchServer::DocumentIdIterator::DocumentIdIterator(std::vector<int>::const_iterator position,
+    std::vector<int>::const_iterator end)
+    : position_(position)
+    , end_(end)
+{
+    SkipRemoved();
+}
+
+SearchServer::DocumentIdIterator::reference SearchServer::DocumentIdIterator::operator*() const {
+    return *position_;
+}
+
+SearchServer::DocumentIdIterator& SearchServer::DocumentIdIterator::operator++() {
+    ++position_;
+    SkipRemoved();
+    return *this;
+}
+
+SearchServer::DocumentIdIterator SearchServer::DocumentIdIterator::operator++(int) {
+    DocumentIdIterator result = *this;
+    ++*this;
+    return result;
+}
+
+bool SearchServer::DocumentIdIterator::operator==(const DocumentIdIterator& other) const {
+    return position_ == other.position_;
+}
+
+bool SearchServer::DocumentIdIterator::operator!=(const DocumentIdIterator& other) const {
+    return position_ != other.position_;
+}
+
+void SearchServer::DocumentIdIterator::SkipRemoved() {
+    while (position_ != end_ && *position_ == removed_document_id_) {
+        ++position_;
+    }
 }
\ No newline at end of file
@@ -3,19 +3,146 @@
 #include "log_duration.h"
 #include "string_processing.h"
 #include "document.h"
-#include "concurrent_map.h"
-
-
+#include "index_segment.h"
+#include "posting_list.h"
+#include "result_cache.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+#include "tokenizer.h"
+#include "top_documents.h"
+
+#include <array>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <cmath>
 #include <numeric>
 #include <execution>
+#include <limits>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
+// A document for SearchServer::AddDocuments; the text must outlive the call
+struct NewDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// How FindTopDocuments walks the postings of the query words
+enum class QueryEvaluation {
+    EXHAUSTIVE,  // scores every posting of every plus word
+    WAND,        // skips documents whose score bound cannot get them into the top
+};
+
+// Documents of one status, or of any status if it is std::nullopt, with
+// ratings in [min_rating, max_rating]. Queries apply a filter as bitmaps of the
+// index before scoring instead of calling a predicate for every document
+struct DocumentFilter {
+    std::optional<DocumentStatus> status = DocumentStatus::ACTUAL;
+    int min_rating = std::numeric_limits<int>::min();
+    int max_rating = std::numeric_limits<int>::max();
+};
+
+struct QueryStats {
+    uint64_t scored_postings = 0;
+    uint64_t scored_documents = 0;
+};
+
+// Document counts IDF is computed from, keyed by query words. An index split
+// into shards sums them over all the shards, so each shard scores like the
+// whole index
+struct CorpusStats {
+    int document_count = 0;
+    std::unordered_map<std::string_view, uint32_t> word_document_counts;
+};
+
+// Approximate heap usage of the index parts in bytes
+struct MemoryUsage {
+    size_t dictionary = 0;
+    size_t postings = 0;
+    size_t forward_index = 0;
+    size_t documents = 0;
+};
+
+// Order-independent 128-bit hash of the set of words of a document. Equal sets
+// always have equal fingerprints and different ones almost never do, so a
+// match only needs checking with SearchServer::HaveSameWords
+struct DocumentFingerprint {
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    bool operator==(const DocumentFingerprint& other) const {
+        return low == other.low && high == other.high;
+    }
+};
+
+struct DocumentFingerprintHasher {
+    size_t operator()(const DocumentFingerprint& fingerprint) const {
+        return static_cast<size_t>(fingerprint.low);
+    }
+};
+
+// What adding a document does when a live document has the same set of words
+enum class DuplicatePolicy {
+    ALLOW,   // no check, the default
+    REPORT,  // adds the document and calls the duplicate handler
+    REJECT,  // calls the duplicate handler instead of adding the document
+};
+
+// Called with the id of the new document and of the live one it duplicates
+using DuplicateHandler = std::function<void(int document_id, int original_document_id)>;
+
+// New documents go to a small mutable segment: plain posting lists in
+// TermData. Once it holds max_mutable_document_count_ documents it is sealed
+// into an immutable IndexSegment, and sealed segments of similar size are
+// merged, so adding a document costs the same however large the index is.
+// Queries run over every segment with IDF taken from index-wide counts and
+// combine the top documents of all of them
 class SearchServer {
 public:
+    // Walks the ids of the documents in insertion order, skipping removed ones
+    class DocumentIdIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int*;
+        using reference = const int&;
+
+        DocumentIdIterator(std::vector<int>::const_iterator position, std::vector<int>::const_iterator end);
+
+        reference operator*() const;
+
+        DocumentIdIterator& operator++();
+
+        DocumentIdIterator operator++(int);
+
+        bool operator==(const DocumentIdIterator& other) const;
+
+        bool operator!=(const DocumentIdIterator& other) const;
+
+    private:
+        std::vector<int>::const_iterator position_;
+        std::vector<int>::const_iterator end_;
+
+        void SkipRemoved();
+    };
+
+    // Scratch memory of queries. A context reused for the queries of one
+    // thread lets them run without heap allocations once it has grown.
+    // With the result cache on, this holds for cache hits only: a miss
+    // inserts copies of its key and results into the cache, which allocates
+    class QueryContext;
 
     template <typename StringContainer>
     explicit SearchServer(const StringContainer& stop_words);
@@ -27,43 +154,167 @@ public:
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status,
         const std::vector<int>& ratings);
 
+    // Adds all the documents or none of them if any id or word is invalid.
+    // Documents are tokenized in parallel into partial indexes which are then
+    // merged into the main one
+    void AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents);
+
+    // Removal leaves a tombstone: the document disappears from results at once,
+    // while its postings stay in its segment until a merge or Compact drops them
     void RemoveDocument(int document_id);
 
     void RemoveDocument(std::execution::sequenced_policy seq, int document_id);
 
     void RemoveDocument(std::execution::parallel_policy par, int document_id);
 
+    // Removes all the documents or none of them if any is missing, throwing
+    // std::out_of_range then
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    // Rewrites segments without their removed documents, the ones with most of
+    // them first, until postings of max_document_count documents are reclaimed,
+    // so it can run in small steps between other calls.
+    // Returns the number of removed documents still holding postings
+    size_t Compact(size_t max_document_count = std::numeric_limits<size_t>::max());
+
+    size_t Compact(std::execution::sequenced_policy seq,
+        size_t max_document_count = std::numeric_limits<size_t>::max());
+
+    // Rewrites the chosen segments in parallel
+    size_t Compact(std::execution::parallel_policy par,
+        size_t max_document_count = std::numeric_limits<size_t>::max());
+
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    std::vector<Document> FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query,
+        const DocumentFilter& filter, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
-    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
-    std::vector<Document> FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
 
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
 
+    // Answers many queries at once, walking the postings of every distinct
+    // word of the batch once per segment instead of once per query. The
+    // results equal the ones of FindTopDocuments for every query
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Splits the queries into a few batches run in parallel
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(std::execution::parallel_policy par,
+        const std::vector<std::string>& raw_queries, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Computes IDF from corpus_stats instead of the counts of this index; the
+    // stats must have been gathered for the same query
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const CorpusStats& corpus_stats,
+        DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const CorpusStats& corpus_stats,
+        const DocumentFilter& filter, size_t max_result_count, QueryEvaluation evaluation) const;
+
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query) const;
 
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query) const;
+
+    // The results stay in the context until its next query
+    template <typename DocumentPredicate>
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query,
+        DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    const std::vector<Document>& FindTopDocuments(QueryContext& context, std::string_view raw_query,
+        const DocumentFilter& filter, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
         
     int GetDocumentCount() const;
 
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    // Adds the live documents of the index and the number of them with every
+    // plus word of the query to corpus_stats
+    void AddQueryCorpusStats(std::string_view raw_query, CorpusStats& corpus_stats) const;
+
+    // Postings and documents scored by all queries since construction or the last reset
+    QueryStats GetQueryStats() const;
+
+    void ResetQueryStats();
+
+    MemoryUsage GetMemoryUsage() const;
+
+    // Every word keeps the log of its document count, and the index the log of
+    // its own, so IDF is a subtraction instead of a log per query word. Both
+    // are updated by the writes which change the counts. With the default 0
+    // every change updates them and IDF stays exact; a positive max_staleness
+    // updates a log only once its count drifts by more than this fraction, so
+    // bulk ingestion skips most of them and scores lag by up to that fraction
+    void SetMaxIdfStaleness(double max_staleness);
 
-    std::vector<int>::const_iterator begin();
+    // Keeps the results of up to capacity queries searched by status; 0 turns
+    // the cache off. Queries with a custom predicate are never cached.
+    // Adding or removing a document makes all the cached results stale
+    void SetResultCacheCapacity(size_t capacity);
 
-    std::vector<int>::const_iterator end();
+    ResultCacheStats GetResultCacheStats() const;
+
+    // Keeps the fingerprints of all the live documents, so adding a document
+    // finds its duplicate in O(W) for W words. The handler runs once the call
+    // which added the documents has finished, so it may change the index.
+    // The policy is not saved in snapshots
+    void SetDuplicatePolicy(DuplicatePolicy policy, DuplicateHandler handler = nullptr);
+
+    // Writes the dictionary, stop words, postings and documents to a binary file.
+    // The file is replaced only once it is complete, so a server loaded from
+    // the same path keeps reading the old one
+    void SaveSnapshot(const std::string& path) const;
+
+    // Maps a file written by SaveSnapshot without tokenizing any text. The
+    // postings are read in place from the mapping, which stays open while
+    // they are in use; the dictionary and the documents are copied out of it
+    static SearchServer LoadSnapshot(const std::string& path);
+
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+
+    // Throws std::out_of_range if the document is missing. Safe to call from
+    // many threads while the index does not change
+    DocumentFingerprint GetDocumentFingerprint(int document_id) const;
+
+    // Whether the documents have the same set of words, ignoring frequencies
+    bool HaveSameWords(int lhs_document_id, int rhs_document_id) const;
+
+    DocumentIdIterator begin() const;
+
+    DocumentIdIterator end() const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
         int document_id) const;
@@ -71,28 +322,172 @@ public:
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::sequenced_policy seq,
         std::string_view raw_query, int document_id) const;
 
+    // A query of a few words gains nothing from threads, so this is the sequential version
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::parallel_policy par,
         std::string_view raw_query, int document_id) const;
 
+    // Matches the query against many documents, e.g. to highlight a page of
+    // results, parsing it only once. Throws std::out_of_range if any of the
+    // documents is missing
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::string_view raw_query, const std::vector<int>& document_ids) const;
+
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::execution::parallel_policy par, std::string_view raw_query, const std::vector<int>& document_ids) const;
+
 private:
     struct DocumentData {
         int rating;
         DocumentStatus status;
+        size_t position = 0;            // in document_ids_
+        uint64_t segment_id = 0;        // postings of a reused id may stay in older segments too
     };
 
-    const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::map<int, std::map<std::string_view, double>> id_word_freqs_;                      //    - id                       
-    std::vector<int> document_ids_;
-    std::map<std::string_view, double> res_;
-    std::map<int, std::string> documents_from_request;
+    struct TermData {
+        PostingList postings;           // in the mutable segment
+        uint32_t document_count = 0;    // live documents of all segments
+        bool is_stop_word = false;
+        uint32_t idf_document_count = 0;        // the document count log_document_count is for
+        double log_document_count = 0.0;
+    };
 
-    bool IsStopWord(const std::string_view word) const;
+    const static size_t document_status_count_ = 4;
+
+    // Ratings, statuses and liveness of the documents of a sealed segment by
+    // their place in its sorted ids, so queries need not look them up in documents_
+    struct DocumentColumns {
+        std::vector<int> ratings;
+        std::vector<DocumentStatus> statuses;
+        std::vector<uint64_t> live_bits;
+        std::array<std::vector<uint64_t>, document_status_count_> status_bits;    // live documents of every status
+        int min_rating = std::numeric_limits<int>::max();                         // of the live documents
+        int max_rating = std::numeric_limits<int>::min();
+    };
+
+    struct SegmentData {
+        std::shared_ptr<const IndexSegment> segment;
+        uint64_t id = 0;
+        size_t live_document_count = 0;
+        DocumentColumns columns;
+    };
+
+    // Marks the place of a removed document in document_ids_
+    constexpr static int removed_document_id_ = -1;
+    const static size_t max_mutable_document_count_ = 4096;
+    const static size_t segment_merge_factor_ = 4;
+    const static size_t batch_window_size_ = 16384;         // document ids scored together by a query batch
+    const static size_t min_parallel_batch_size_ = 256;
+
+    TermDictionary dictionary_;
+    Tokenizer tokenizer_;
+    std::vector<TermData> terms_;                                                          // indexed by term id
+    std::map<int, DocumentData> documents_;
+    std::map<int, std::vector<std::pair<uint32_t, double>>> id_word_freqs_;                //    - id,    id
+    std::vector<int> document_ids_;                                                        // in insertion order
+    size_t removed_position_count_ = 0;
+    std::vector<SegmentData> segments_;                                                    // sealed ones
+    uint64_t mutable_segment_id_ = 0;
+    uint64_t next_segment_id_ = 1;
+    std::vector<uint32_t> mutable_term_ids_;                                               // terms with postings in the mutable segment
+    std::vector<int> mutable_document_ids_;
+    size_t mutable_live_document_count_ = 0;
+    std::unordered_set<int> mutable_removed_document_ids_;
+    mutable std::atomic<uint64_t> scored_postings_{ 0 };
+    mutable std::atomic<uint64_t> scored_documents_{ 0 };
+    uint64_t generation_ = 0;                                                              // changed by every write
+    double max_idf_staleness_ = 0.0;
+    int idf_document_count_ = 0;                                                           // the document count log_document_count_ is for
+    double log_document_count_ = 0.0;
+    std::unique_ptr<ResultCache> result_cache_;
+    DuplicatePolicy duplicate_policy_ = DuplicatePolicy::ALLOW;
+    DuplicateHandler duplicate_handler_;
+    std::unordered_multimap<DocumentFingerprint, int, DocumentFingerprintHasher> document_fingerprints_;   // empty if duplicates are allowed
+
+    // storage keeps the snapshot memory alive for the segment read in place
+    SearchServer(SnapshotReader& reader, std::shared_ptr<const void> storage);
 
     static bool IsValidWord(const std::string_view word);
 
-    std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view text) const;
+    uint32_t AddTerm(const std::string_view word);
+
+    // Turns the ids of the document words into sorted pairs of id and term frequency
+    static std::vector<std::pair<uint32_t, double>> ComputeTermFreqs(std::vector<uint32_t> term_ids);
+
+    static DocumentFingerprint ComputeFingerprint(const std::vector<std::pair<uint32_t, double>>& word_freqs);
+
+    static bool HaveSameTerms(const std::vector<std::pair<uint32_t, double>>& lhs_word_freqs,
+        const std::vector<std::pair<uint32_t, double>>& rhs_word_freqs);
+
+    // Returns the id of a live document with the same words, if there is one
+    std::optional<int> FindDuplicate(const DocumentFingerprint& fingerprint,
+        const std::vector<std::pair<uint32_t, double>>& word_freqs) const;
+
+    // Checks a new document against the fingerprints and records it there
+    // unless it is rejected. Returns whether the document should be added
+    bool RegisterFingerprint(int document_id, const std::vector<std::pair<uint32_t, double>>& word_freqs,
+        std::vector<std::pair<int, int>>& duplicates);
+
+    void ReportDuplicates(const std::vector<std::pair<int, int>>& duplicates) const;
+
+    // RemoveDocument without the upkeep which a batch of removals needs only once
+    void RemoveDocumentData(int document_id);
+
+    // Inverted index of a part of a document batch; its words are numbered
+    // locally until the merge puts them into the dictionary
+    struct PartialIndex {
+        std::unordered_map<std::string_view, uint32_t> word_ids;
+        std::vector<std::string_view> words;
+        std::vector<std::vector<std::pair<int, float>>> postings;
+        std::vector<std::vector<std::pair<uint32_t, double>>> document_word_freqs;
+        std::vector<std::string_view> text_words;           // of the current document
+        std::exception_ptr error;
+    };
+
+    void AddToPartialIndex(const NewDocument& document, PartialIndex& partial_index) const;
+
+    void MergePartialIndex(PartialIndex& partial_index, const std::vector<const NewDocument*>& documents,
+        std::vector<std::pair<int, int>>& duplicates);
+
+    // Returns term ids of the non-stop words, adding new words to the
+    // dictionary. A document with a new word duplicates no other, so the words
+    // of a rejected duplicate are all known and it adds nothing
+    std::vector<uint32_t> SplitIntoTermIdsNoStop(const std::string_view text);
+
+    void AddTermPosting(uint32_t term_id, int document_id, float term_freq);
+
+    // Registers a document whose postings are in the mutable segment
+    void AddDocumentData(int document_id, int rating, DocumentStatus status);
+
+    void RemoveDocumentIdHoles();
+
+    // A copy of the mutable segment
+    IndexSegment BuildMutableSegment() const;
+
+    void SealMutableSegment();
+
+    static size_t GetSegmentTier(size_t document_count);
+
+    void ApplyMergePolicy();
+
+    // Sorted ids of the documents of the segment which were removed or added again later
+    std::vector<int> FindRemovedDocuments(const IndexSegment& segment, uint64_t segment_id,
+        size_t live_document_count) const;
+
+    std::shared_ptr<const IndexSegment> MergeSegments(const std::vector<size_t>& segment_indexes) const;
+
+    DocumentColumns BuildDocumentColumns(const IndexSegment& segment, uint64_t segment_id) const;
+
+    // Replaces the segments with the merged one
+    void ReplaceSegments(std::vector<size_t> segment_indexes, std::shared_ptr<const IndexSegment> merged);
+
+    size_t GetRemovedDocumentCount() const;
+
+    template <typename ExecutionPolicy>
+    size_t CompactSegments(const ExecutionPolicy& policy, size_t max_document_count);
+
+    // Returns the first position from first on whose term is not below term_id,
+    // galloping since the terms of a query are looked up in ascending order
+    static size_t FindTerm(const std::vector<std::pair<uint32_t, double>>& word_freqs, size_t first, uint32_t term_id);
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
@@ -100,175 +495,517 @@ private:
         std::string_view data;
         bool is_minus;
         bool is_stop;
+        std::optional<uint32_t> term_id;
     };
 
     QueryWord ParseQueryWord(const std::string_view text) const;
 
+    // Words missing from the dictionary cannot match anything and are dropped
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        std::vector<uint32_t> plus_words;
+        std::vector<uint32_t> minus_words;
+        std::vector<double> plus_word_inverse_document_freqs;     // by plus word; unused for words without live documents
     };
 
-    Query ParseQuery(std::string_view text) const;
+    // Fills query reusing its memory and the one of words
+    void ParseQuery(std::string_view text, std::vector<std::string_view>& words, Query& query) const;
+
+    // Looks the query up in the result cache, running search on a miss
+    template <typename Search>
+    std::vector<Document> FindCachedDocuments(const Query& query, DocumentStatus status, size_t max_result_count,
+        Search search) const;
+
+    // Sorts the words of the query and drops repeated ones
+    Query ParseUniqueQuery(std::string_view text) const;
+
+    void ParseUniqueQuery(std::string_view text, std::vector<std::string_view>& words, Query& query) const;
+
+    // Intersects the sorted query words with the sorted words of the document
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchQuery(const Query& query, int document_id) const;
 
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    double ComputeWordInverseDocumentFreq(uint32_t term_id) const;
+
+    // Fills the IDF of the plus words, once per query rather than per segment.
+    // Only searches need it, so ParseUniqueQuery leaves it empty
+    void ComputeQueryInverseDocumentFreqs(Query& query) const;
+
+    // Called when the document count of the word changes
+    void UpdateInverseDocumentFreq(TermData& term);
+
+    // Called when the document count of the index changes
+    void UpdateDocumentCountLog();
+
+    // Recomputes the logs of all the words and of the index, however stale
+    void RefreshInverseDocumentFreqs();
+
+    struct ScoredPostings {
+        PostingList::Cursor postings;   // a cursor at the first posting
+        double inverse_document_freq;
+    };
 
+    // Postings of the query words in one segment
+    struct QueryPostings {
+        const SegmentData* segment = nullptr;       // nullptr for the mutable segment
+        std::vector<ScoredPostings> plus_postings;
+        std::vector<PostingList::Cursor> minus_postings;
+    };
+
+    // Cursors and bounds of a query in one segment, reused from range to range
+    struct CursorBuffers {
+        std::vector<PostingList::Cursor> plus_cursors;
+        std::vector<PostingList::Cursor> minus_cursors;
+        std::vector<double> max_scores;
+        std::vector<size_t> order;
+    };
+
+    // segment is nullptr for the mutable segment
+    void FindQueryPostings(const Query& query, const SegmentData* segment, QueryPostings& query_postings) const;
+
+    // Skips segments without postings of the plus words
+    std::vector<QueryPostings> FindSegmentQueryPostings(const Query& query) const;
+
+    // Last ids of at most range_count ranges with about the same number of
+    // plus word postings; the last range ends with last_document_id
+    static std::vector<int> SplitByPostings(const std::vector<QueryPostings>& segment_query_postings,
+        int last_document_id, size_t range_count);
+
+    // Decides which documents of one segment a query may return: a sealed
+    // segment answers from its columns, the mutable one from documents_.
+    // Ids must be asked in ascending order
+    class SegmentDocumentFilter {
+    public:
+        // segment is nullptr for the mutable segment
+        SegmentDocumentFilter(const SearchServer& server, const SegmentData* segment, const DocumentFilter& filter);
+
+        // Returns the first id from document_id on which may pass the filter,
+        // or a value above the int range if there is none
+        int64_t SkipRejected(int document_id);
+
+        // Returns false for removed documents and the ones the filter rejects
+        bool Accept(int document_id, DocumentStatus& status, int& rating);
+
+    private:
+        const SearchServer& server_;
+        const SegmentData* segment_;
+        DocumentFilter filter_;
+        const std::vector<uint64_t>* bits_ = nullptr;   // of the filter status, or all live documents
+        bool checks_rating_ = false;                    // if the segment has ratings out of the range
+        bool is_empty_ = false;
+        size_t position_ = 0;                           // of the last asked document in the segment
+
+        size_t FindPosition(int document_id);
+
+        bool HasAcceptedRating(size_t position) const;
+    };
+
+    // The predicate of queries that use only a DocumentFilter
+    struct AnyDocument {
+        bool operator()(int, DocumentStatus, int) const {
+            return true;
+        }
+    };
+
+    template <typename DocumentPredicate>
+    void FindDocumentsInRange(const QueryPostings& query_postings, const DocumentFilter& filter,
+        DocumentPredicate document_predicate, int first_document_id, int last_document_id, QueryEvaluation evaluation,
+        CursorBuffers& buffers, TopDocumentsCollector& top_documents) const;
+
+    template <typename DocumentPredicate>
+    void FindDocumentsInRangeWand(const QueryPostings& query_postings, const DocumentFilter& filter,
+        DocumentPredicate document_predicate, int first_document_id, int last_document_id, CursorBuffers& buffers,
+        TopDocumentsCollector& top_documents) const;
+
+    static void OpenPlusCursors(const QueryPostings& query_postings, int first_document_id,
+        std::vector<PostingList::Cursor>& cursors);
+
+    static void OpenMinusCursors(const QueryPostings& query_postings, int first_document_id,
+        std::vector<PostingList::Cursor>& cursors);
+
+    static bool IsExcluded(std::vector<PostingList::Cursor>& minus_cursors, int document_id);
+
+    void AddQueryStats(uint64_t scored_postings, uint64_t scored_documents) const;
+
+    // The distinct words of a query batch in ascending id order, with the
+    // queries using each of them
+    struct QueryBatch {
+        std::vector<uint32_t> term_ids;
+        std::vector<double> inverse_document_freqs;          // of plus words which are in some live document
+        std::vector<std::vector<uint32_t>> plus_queries;
+        std::vector<std::vector<uint32_t>> minus_queries;
+    };
+
+    QueryBatch GroupQueries(std::vector<std::string>::const_iterator first_query,
+        std::vector<std::string>::const_iterator last_query) const;
+
+    std::vector<std::vector<Document>> FindBatchDocuments(const QueryBatch& batch, size_t query_count,
+        DocumentStatus status, size_t max_result_count) const;
+
+    // State reused by all the segments of a batch
+    struct BatchScores {
+        struct Posting {
+            uint32_t term_index;
+            float term_freq;
+        };
+
+        // Postings of a window of ids with the id offsets in it, first in
+        // the order of the words and then sorted by document
+        std::vector<std::pair<uint32_t, Posting>> window_postings;
+        std::vector<std::pair<uint32_t, Posting>> sorted_postings;
+        std::vector<uint32_t> window_offsets;
+        std::vector<double> relevances;                  // by query
+        std::vector<uint64_t> relevance_stamps;
+        std::vector<uint64_t> exclusion_stamps;
+        std::vector<uint32_t> scored_queries;
+        uint64_t stamp = 0;
+    };
+
+    // segment is nullptr for the mutable segment
+    void FindSegmentBatchDocuments(const QueryBatch& batch, const SegmentData* segment,
+        DocumentStatus status, BatchScores& scores, std::vector<TopDocumentsCollector>& top_documents) const;
+
+    // Documents pass if they pass both filter and document_predicate; the
+    // predicate is called once per scored document
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query,
-        DocumentPredicate document_predicate) const;
+    std::vector<Document> FindAllDocuments(const Query& query, const DocumentFilter& filter,
+        DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const;
+
+    // Walks the segments one by one, so one set of buffers serves all of them
+    template <typename DocumentPredicate>
+    void FindAllDocuments(const Query& query, const DocumentFilter& filter, DocumentPredicate document_predicate,
+        QueryEvaluation evaluation, QueryPostings& query_postings, CursorBuffers& buffers,
+        TopDocumentsCollector& top_documents) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(std::execution::parallel_policy par, const Query& query,
-        DocumentPredicate document_predicate) const;
+        const DocumentFilter& filter, DocumentPredicate document_predicate, size_t max_result_count,
+        QueryEvaluation evaluation) const;
+};
+
+class SearchServer::QueryContext {
+private:
+    friend class SearchServer;
+
+    std::vector<std::string_view> words_;
+    Query query_;
+    QueryPostings query_postings_;
+    CursorBuffers cursor_buffers_;
+    TopDocumentsCollector top_documents_{ 0 };
+    std::vector<Document> documents_;
+    ResultCacheKey cache_key_;
 };
 
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))  // Extract non-empty stop words
-{
-    if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
+SearchServer::SearchServer(const StringContainer& stop_words) {
+    const auto unique_stop_words = MakeUniqueNonEmptyStrings(stop_words);  // Extract non-empty stop words
+    if (!all_of(unique_stop_words.begin(), unique_stop_words.end(), IsValidWord)) {
         using namespace std::literals;
         throw std::invalid_argument("Some of stop words are invalid"s);
     }
+    for (const std::string& stop_word : unique_stop_words) {
+        terms_[AddTerm(stop_word)].is_stop_word = true;
+    }
+    tokenizer_ = Tokenizer({ unique_stop_words.begin(), unique_stop_words.end() });
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
     // LOG_DURATION_STREAM("Operation time", std::cout);
-    auto query = ParseQuery(raw_query);
-    std::sort(query.plus_words.begin(), query.plus_words.end());
-    query.plus_words.erase(std::unique(query.plus_words.begin(), query.plus_words.end()),
-        query.plus_words.end());
-
-    std::sort(query.minus_words.begin(), query.minus_words.end());
-
-    query.minus_words.erase(std::unique(query.minus_words.begin(),
-        query.minus_words.end()), query.minus_words.end());
-    auto matched_documents = SearchServer::FindAllDocuments(query, document_predicate);
-
-    sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            constexpr double exp = 1e-6;
-            if (std::abs(lhs.relevance - rhs.relevance) < exp) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
+    auto query = ParseUniqueQuery(raw_query);
+    ComputeQueryInverseDocumentFreqs(query);
+    return SearchServer::FindAllDocuments(query, DocumentFilter{ std::nullopt }, document_predicate, max_result_count,
+        evaluation);
+}
 
-    return matched_documents;
+template <typename DocumentPredicate>
+const std::vector<Document>& SearchServer::FindTopDocuments(QueryContext& context, std::string_view raw_query,
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    ParseUniqueQuery(raw_query, context.words_, context.query_);
+    ComputeQueryInverseDocumentFreqs(context.query_);
+    context.top_documents_.Reset(max_result_count);
+    FindAllDocuments(context.query_, DocumentFilter{ std::nullopt }, document_predicate, evaluation,
+        context.query_postings_, context.cursor_buffers_, context.top_documents_);
+    context.top_documents_.Extract(context.documents_);
+    return context.documents_;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const CorpusStats& corpus_stats,
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    auto query = ParseUniqueQuery(raw_query);
+    for (uint32_t term_id : query.plus_words) {
+        // Unused when no document has the word: such words are skipped
+        query.plus_word_inverse_document_freqs.push_back(log(corpus_stats.document_count * 1.0
+            / corpus_stats.word_document_counts.at(dictionary_.GetTerm(term_id))));
+    }
+    return SearchServer::FindAllDocuments(query, DocumentFilter{ std::nullopt }, document_predicate, max_result_count,
+        evaluation);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy seq, std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
-    return SearchServer::FindTopDocuments(raw_query, document_predicate);
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    return SearchServer::FindTopDocuments(raw_query, document_predicate, max_result_count, evaluation);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy par, std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
-    auto query = ParseQuery(raw_query);
-    std::sort(query.plus_words.begin(), query.plus_words.end());
-    query.plus_words.erase(std::unique(std::execution::par, query.plus_words.begin(), query.plus_words.end()),
-        query.plus_words.end());
-
-    std::sort(query.minus_words.begin(), query.minus_words.end());
-    query.minus_words.erase(std::unique(std::execution::par, query.minus_words.begin(),
-        query.minus_words.end()), query.minus_words.end());
-
-    auto matched_documents = SearchServer::FindAllDocuments(par, query, document_predicate);
-
-    std::sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            constexpr double exp = 1e-6;
-            if (std::abs(lhs.relevance - rhs.relevance) < exp) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    auto query = ParseUniqueQuery(raw_query);
+    ComputeQueryInverseDocumentFreqs(query);
+
+    return SearchServer::FindAllDocuments(par, query, DocumentFilter{ std::nullopt }, document_predicate,
+        max_result_count, evaluation);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const Query& query, const DocumentFilter& filter,
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    QueryPostings query_postings;
+    CursorBuffers buffers;
+    TopDocumentsCollector top_documents(max_result_count);
+    FindAllDocuments(query, filter, document_predicate, evaluation, query_postings, buffers, top_documents);
+    return top_documents.Extract();
+}
+
+template <typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const Query& query, const DocumentFilter& filter,
+    DocumentPredicate document_predicate, QueryEvaluation evaluation, QueryPostings& query_postings,
+    CursorBuffers& buffers, TopDocumentsCollector& top_documents) const {
+    const auto find_documents = [&](const SegmentData* segment) {
+        FindQueryPostings(query, segment, query_postings);
+        if (!query_postings.plus_postings.empty()) {
+            FindDocumentsInRange(query_postings, filter, document_predicate, 0, std::numeric_limits<int>::max(),
+                evaluation, buffers, top_documents);
+        }
+    };
+    for (const SegmentData& segment : segments_) {
+        find_documents(&segment);
+    }
+    find_documents(nullptr);
+}
+
+// The id space is cut into ranges scored independently: every range of every
+// segment walks its own slice of the postings and keeps its own top documents,
+// so threads share nothing until the final merge. Ranges hold about the same
+// number of postings, so dense id spans do not end up in one task
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy par, const Query& query,
+    const DocumentFilter& filter, DocumentPredicate document_predicate, size_t max_result_count,
+    QueryEvaluation evaluation) const {
+    if (documents_.empty()) {
+        return {};
     }
+    const std::vector<QueryPostings> segment_query_postings = FindSegmentQueryPostings(query);
+    const int first_document_id = documents_.begin()->first;
+    const std::vector<int> range_last_ids = SplitByPostings(segment_query_postings, documents_.rbegin()->first,
+        std::max(1u, std::thread::hardware_concurrency()) * 4);
+    const size_t range_count = range_last_ids.size();
+
+    const size_t task_count = range_count * segment_query_postings.size();
+    std::vector<TopDocumentsCollector> range_top_documents(task_count, TopDocumentsCollector(max_result_count));
+    std::vector<size_t> task_indexes(task_count);
+    std::iota(task_indexes.begin(), task_indexes.end(), 0);
+    std::for_each(std::execution::par, task_indexes.begin(), task_indexes.end(), [&](size_t task_index) {
+        CursorBuffers buffers;
+        const size_t range_index = task_index % range_count;
+        const int first_id = range_index == 0 ? first_document_id : range_last_ids[range_index - 1] + 1;
+        FindDocumentsInRange(segment_query_postings[task_index / range_count], filter, document_predicate,
+            first_id, range_last_ids[range_index], evaluation, buffers, range_top_documents[task_index]);
+        });
 
-    return matched_documents;
+    TopDocumentsCollector top_documents(max_result_count);
+    for (TopDocumentsCollector& range_top : range_top_documents) {
+        for (const Document& document : range_top.Extract()) {
+            top_documents.Add(document);
+        }
+    }
+    return top_documents.Extract();
 }
 
-    template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
-    DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+// Scores documents with ids in [first_document_id, last_document_id] one at a
+// time, advancing the cursors of all query words together. Documents the
+// filter rejects are skipped before they are scored
+template <typename DocumentPredicate>
+void SearchServer::FindDocumentsInRange(const QueryPostings& query_postings, const DocumentFilter& filter,
+    DocumentPredicate document_predicate, int first_document_id, int last_document_id, QueryEvaluation evaluation,
+    CursorBuffers& buffers, TopDocumentsCollector& top_documents) const {
+    if (evaluation == QueryEvaluation::WAND) {
+        FindDocumentsInRangeWand(query_postings, filter, document_predicate, first_document_id, last_document_id,
+            buffers, top_documents);
+        return;
+    }
+    SegmentDocumentFilter document_filter(*this, query_postings.segment, filter);
+    std::vector<PostingList::Cursor>& plus_cursors = buffers.plus_cursors;
+    std::vector<PostingList::Cursor>& minus_cursors = buffers.minus_cursors;
+    OpenPlusCursors(query_postings, first_document_id, plus_cursors);
+    OpenMinusCursors(query_postings, first_document_id, minus_cursors);
+    uint64_t scored_postings = 0;
+    uint64_t scored_documents = 0;
+
+    while (true) {
+        bool found = false;
+        int document_id = last_document_id;
+        for (const PostingList::Cursor& cursor : plus_cursors) {
+            if (!cursor.IsEnd() && cursor.GetDocumentId() <= document_id) {
+                document_id = cursor.GetDocumentId();
+                found = true;
+            }
+        }
+        if (!found) {
+            break;
+        }
+        const int64_t accepted_document_id = document_filter.SkipRejected(document_id);
+        if (accepted_document_id > last_document_id) {
+            break;
+        }
+        if (accepted_document_id != document_id) {
+            for (PostingList::Cursor& cursor : plus_cursors) {
+                if (!cursor.IsEnd() && cursor.GetDocumentId() < accepted_document_id) {
+                    cursor.SkipTo(static_cast<int>(accepted_document_id));
+                }
+            }
             continue;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+
+        double relevance = 0.0;
+        for (size_t i = 0; i < plus_cursors.size(); ++i) {
+            if (!plus_cursors[i].IsEnd() && plus_cursors[i].GetDocumentId() == document_id) {
+                relevance += plus_cursors[i].GetTermFreq() * query_postings.plus_postings[i].inverse_document_freq;
+                plus_cursors[i].Next();
+                ++scored_postings;
             }
         }
-    }
+        ++scored_documents;
 
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+        if (IsExcluded(minus_cursors, document_id)) {
             continue;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+        DocumentStatus status;
+        int rating;
+        if (document_filter.Accept(document_id, status, rating) && document_predicate(document_id, status, rating)) {
+            top_documents.Add({ document_id, relevance, rating });
         }
     }
-
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
-    }
-    return matched_documents;
+    AddQueryStats(scored_postings, scored_documents);
 }
 
+// Block-max WAND: the cursors are kept ordered by their current document, and
+// the pivot is the first document where the sum of per-word score bounds
+// reaches the relevance needed to enter the top. Documents before the pivot
+// cannot make it, so the lagging cursors jump straight to it, and so they do
+// over documents the filter rejects. Relevance is still summed in query word
+// order, so the results equal the exhaustive ones
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy par, const Query& query,
-    DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(query.plus_words.size());
-    
-    std::for_each(std::execution::par, query.plus_words.begin(), query.plus_words.end(), [&](std::string_view plus_word) {
-        if (word_to_document_freqs_.count(plus_word) == 0) {
-            return;
+void SearchServer::FindDocumentsInRangeWand(const QueryPostings& query_postings, const DocumentFilter& filter,
+    DocumentPredicate document_predicate, int first_document_id, int last_document_id, CursorBuffers& buffers,
+    TopDocumentsCollector& top_documents) const {
+    SegmentDocumentFilter document_filter(*this, query_postings.segment, filter);
+    std::vector<PostingList::Cursor>& plus_cursors = buffers.plus_cursors;
+    std::vector<PostingList::Cursor>& minus_cursors = buffers.minus_cursors;
+    OpenPlusCursors(query_postings, first_document_id, plus_cursors);
+    OpenMinusCursors(query_postings, first_document_id, minus_cursors);
+    std::vector<double>& max_scores = buffers.max_scores;
+    max_scores.clear();
+    for (const auto& [postings, inverse_document_freq] : query_postings.plus_postings) {
+        max_scores.push_back(postings.GetMaxTermFreq() * inverse_document_freq);
+    }
+    std::vector<size_t>& order = buffers.order;
+    order.resize(plus_cursors.size());
+    std::iota(order.begin(), order.end(), 0);
+    uint64_t scored_postings = 0;
+    uint64_t scored_documents = 0;
+
+    while (true) {
+        order.erase(std::remove_if(order.begin(), order.end(), [&](size_t i) {
+            return plus_cursors[i].IsEnd() || plus_cursors[i].GetDocumentId() > last_document_id;
+            }), order.end());
+        std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+            return plus_cursors[lhs].GetDocumentId() < plus_cursors[rhs].GetDocumentId();
+            });
+
+        const double min_relevance = top_documents.GetMinRelevance();
+        double max_relevance = 0.0;
+        size_t pivot = 0;
+        while (pivot < order.size()) {
+            max_relevance += max_scores[order[pivot]];
+            if (max_relevance >= min_relevance) {
+                break;
+            }
+            ++pivot;
+        }
+        if (pivot == order.size()) {
+            break;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(plus_word);
 
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(plus_word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+        const int document_id = plus_cursors[order[pivot]].GetDocumentId();
+        if (plus_cursors[order.front()].GetDocumentId() != document_id) {
+            for (size_t i = 0; i < pivot; ++i) {
+                plus_cursors[order[i]].SkipTo(document_id);
             }
+            continue;
         }
-        });
-    
-    std::for_each(std::execution::par, query.minus_words.begin(), query.minus_words.end(), [&](std::string_view minus_word) {
-        if (word_to_document_freqs_.count(minus_word) == 0) {
-            return;
+        const int64_t accepted_document_id = document_filter.SkipRejected(document_id);
+        if (accepted_document_id > last_document_id) {
+            break;
         }
-         for (const auto [document_id, _] : word_to_document_freqs_.at(minus_word)) {
-             document_to_relevance.Erase(document_id);
+        if (accepted_document_id != document_id) {
+            for (size_t i : order) {
+                if (plus_cursors[i].GetDocumentId() >= accepted_document_id) {
+                    break;
+                }
+                plus_cursors[i].SkipTo(static_cast<int>(accepted_document_id));
+            }
+            continue;
+        }
+
+        // Block-max check: until the end of the shortest current block the
+        // pivot words cannot score more than their block maxima
+        double block_max_relevance = 0.0;
+        int64_t next_document_id = static_cast<int64_t>(std::numeric_limits<int>::max()) + 1;
+        for (size_t i : order) {
+            if (plus_cursors[i].GetDocumentId() == document_id) {
+                block_max_relevance += plus_cursors[i].GetBlockMaxTermFreq()
+                    * query_postings.plus_postings[i].inverse_document_freq;
+                next_document_id = std::min<int64_t>(next_document_id, plus_cursors[i].GetBlockLastDocumentId() + int64_t{ 1 });
+            }
+            else {
+                next_document_id = std::min<int64_t>(next_document_id, plus_cursors[i].GetDocumentId());
+            }
+        }
+        if (block_max_relevance < min_relevance) {
+            for (size_t i : order) {
+                if (plus_cursors[i].GetDocumentId() != document_id) {
+                    break;
+                }
+                if (next_document_id > std::numeric_limits<int>::max()) {
+                    plus_cursors[i].Next();
+                }
+                else {
+                    plus_cursors[i].SkipTo(static_cast<int>(next_document_id));
+                }
+            }
+            continue;
+        }
+
+        double relevance = 0.0;
+        for (size_t i = 0; i < plus_cursors.size(); ++i) {
+            if (!plus_cursors[i].IsEnd() && plus_cursors[i].GetDocumentId() == document_id) {
+                relevance += plus_cursors[i].GetTermFreq() * query_postings.plus_postings[i].inverse_document_freq;
+                plus_cursors[i].Next();
+                ++scored_postings;
+            }
+        }
+        ++scored_documents;
+
+        if (IsExcluded(minus_cursors, document_id)) {
+            continue;
+        }
+        DocumentStatus status;
+        int rating;
+        if (document_filter.Accept(document_id, status, rating) && document_predicate(document_id, status, rating)) {
+            top_documents.Add({ document_id, relevance, rating });
         }
-        });    
-    
-    std::vector<Document> matched_documents;
-       
-    for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
     }
-    
-    return matched_documents;
-}
\ No newline at end of file
+    AddQueryStats(scored_postings, scored_documents);
+}
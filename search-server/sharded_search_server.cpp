@@ -0,0 +1,115 @@
+#include "sharded_search_server.h"
+
+#include <exception>
+#include <functional>
+#include <numeric>
+
+void ShardedSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    GetShard(document_id).AddDocument(document_id, document, status, ratings);
+}
+
+// A shard adds its part of the batch or nothing, so when one of them throws
+// the parts added by the others are removed again
+void ShardedSearchServer::AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents) {
+    std::vector<std::vector<NewDocument>> shard_documents(shards_.size());
+    for (const NewDocument& document : documents) {
+        shard_documents[std::hash<int>{}(document.id) % shards_.size()].push_back(document);
+    }
+    std::vector<size_t> shard_indexes(shards_.size());
+    std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+    std::vector<std::exception_ptr> errors(shards_.size());
+    std::for_each(par, shard_indexes.begin(), shard_indexes.end(), [&](size_t i) {
+        try {
+            shards_[i].AddDocuments(par, shard_documents[i]);
+        }
+        catch (...) {
+            errors[i] = std::current_exception();
+        }
+        });
+
+    const auto error = std::find_if(errors.begin(), errors.end(), [](const std::exception_ptr& e) {return e != nullptr; });
+    if (error == errors.end()) {
+        return;
+    }
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        if (errors[i] == nullptr) {
+            for (const NewDocument& document : shard_documents[i]) {
+                shards_[i].RemoveDocument(document.id);
+            }
+        }
+    }
+    std::rethrow_exception(*error);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+    GetShard(document_id).RemoveDocument(document_id);
+}
+
+void ShardedSearchServer::Compact() {
+    std::for_each(std::execution::par, shards_.begin(), shards_.end(), [](SearchServer& shard) {
+        shard.Compact();
+        });
+}
+
+// The shards get the filter itself, so they apply it as bitmaps
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    return FindTopDocuments<DocumentFilter>(raw_query, filter, max_result_count, evaluation);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count, QueryEvaluation evaluation) const {
+    return FindTopDocuments(raw_query, DocumentFilter{ status }, max_result_count, evaluation);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return GetShard(document_id).MatchDocument(raw_query, document_id);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+    int document_count = 0;
+    for (const SearchServer& shard : shards_) {
+        document_count += shard.GetDocumentCount();
+    }
+    return document_count;
+}
+
+size_t ShardedSearchServer::GetShardCount() const {
+    return shards_.size();
+}
+
+MemoryUsage ShardedSearchServer::GetMemoryUsage() const {
+    MemoryUsage memory_usage;
+    for (const SearchServer& shard : shards_) {
+        const MemoryUsage shard_usage = shard.GetMemoryUsage();
+        memory_usage.dictionary += shard_usage.dictionary;
+        memory_usage.postings += shard_usage.postings;
+        memory_usage.forward_index += shard_usage.forward_index;
+        memory_usage.documents += shard_usage.documents;
+    }
+    return memory_usage;
+}
+
+const SearchServer& ShardedSearchServer::GetShard(int document_id) const {
+    return shards_[std::hash<int>{}(document_id) % shards_.size()];
+}
+
+SearchServer& ShardedSearchServer::GetShard(int document_id) {
+    return shards_[std::hash<int>{}(document_id) % shards_.size()];
+}
+
+// Gathered before the shards start, so a query with an invalid word throws
+// without running anywhere
+CorpusStats ShardedSearchServer::GetQueryCorpusStats(std::string_view raw_query) const {
+    CorpusStats corpus_stats;
+    for (const SearchServer& shard : shards_) {
+        shard.AddQueryCorpusStats(raw_query, corpus_stats);
+    }
+    return corpus_stats;
+}
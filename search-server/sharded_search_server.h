@@ -0,0 +1,118 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Documents split by id between several SearchServer shards. A query runs on
+// all the shards in parallel and their top documents are merged. IDF is
+// computed from the document counts of all the shards, so the results are the
+// ones of a single SearchServer with the same documents. Only relevance may
+// differ in the last bit: shards number words differently, and a document sums
+// the scores of its words in the order of their ids
+class ShardedSearchServer {
+public:
+    template <typename StopWords>
+    ShardedSearchServer(const StopWords& stop_words,
+        size_t shard_count = std::max(1u, std::thread::hardware_concurrency()));
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+
+    // Adds all the documents or none of them, filling the shards in parallel
+    void AddDocuments(std::execution::parallel_policy par, const std::vector<NewDocument>& documents);
+
+    void RemoveDocument(int document_id);
+
+    // Compacts the shards in parallel
+    void Compact();
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT,
+        QueryEvaluation evaluation = QueryEvaluation::EXHAUSTIVE) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+
+    // Only the shard of the document is asked
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+
+    int GetDocumentCount() const;
+
+    size_t GetShardCount() const;
+
+    MemoryUsage GetMemoryUsage() const;
+
+private:
+    std::deque<SearchServer> shards_;
+
+    const SearchServer& GetShard(int document_id) const;
+
+    SearchServer& GetShard(int document_id);
+
+    CorpusStats GetQueryCorpusStats(std::string_view raw_query) const;
+};
+
+template <typename StopWords>
+ShardedSearchServer::ShardedSearchServer(const StopWords& stop_words, size_t shard_count) {
+    using namespace std::literals;
+    if (shard_count == 0) {
+        throw std::invalid_argument("Shard count must be positive"s);
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.emplace_back(stop_words);
+    }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, size_t max_result_count, QueryEvaluation evaluation) const {
+    const CorpusStats corpus_stats = GetQueryCorpusStats(raw_query);
+    std::vector<std::vector<Document>> shard_documents(shards_.size());
+    // An exception escaping a parallel algorithm terminates the program, so
+    // the one of a shard, such as from the predicate, is rethrown after it
+    std::vector<std::exception_ptr> errors(shards_.size());
+    std::vector<size_t> shard_indexes(shards_.size());
+    std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+    std::for_each(std::execution::par, shard_indexes.begin(), shard_indexes.end(), [&](size_t i) {
+        try {
+            shard_documents[i] = shards_[i].FindTopDocuments(raw_query, corpus_stats, document_predicate,
+                max_result_count, evaluation);
+        }
+        catch (...) {
+            errors[i] = std::current_exception();
+        }
+        });
+    for (const std::exception_ptr& error : errors) {
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    TopDocumentsCollector top_documents(max_result_count);
+    for (const std::vector<Document>& documents : shard_documents) {
+        for (const Document& document : documents) {
+            top_documents.Add(document);
+        }
+    }
+    return top_documents.Extract();
+}
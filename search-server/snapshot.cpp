@@ -0,0 +1,224 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = { 'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_BYTE_ORDER_MARK = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint64_t payload_size;
+    uint64_t checksum;
+};
+static_assert(sizeof(SnapshotHeader) % alignof(uint64_t) == 0);
+
+const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+#ifdef _WIN32
+
+// Write-through makes the move wait until the file is on disk. Replacing a
+// file which is still mapped fails here instead of pulling it from the mapping
+void ReplaceFile(const std::string& source, const std::string& target) {
+    if (!MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        throw std::runtime_error("Cannot replace snapshot file "s + target);
+    }
+}
+
+#else
+
+void SyncFile(const std::string& path, int flags) {
+    const int fd = open(path.c_str(), flags);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open "s + path + " to sync it"s);
+    }
+    const bool is_synced = fsync(fd) == 0;
+    close(fd);
+    if (!is_synced) {
+        throw std::runtime_error("Cannot sync "s + path);
+    }
+}
+
+// The data reaches the disk before the rename, and the rename before return
+void ReplaceFile(const std::string& source, const std::string& target) {
+    SyncFile(source, O_WRONLY);
+    if (std::rename(source.c_str(), target.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace snapshot file "s + target);
+    }
+    const size_t slash = target.rfind('/');
+    SyncFile(slash == std::string::npos ? "."s : target.substr(0, slash + 1), O_RDONLY);
+}
+
+#endif
+
+} // namespace
+
+void SnapshotChecksum::Update(const char* data, size_t size) {
+    length_ += size;
+    while (tail_size_ > 0 && size > 0) {
+        tail_[tail_size_++] = *data++;
+        --size;
+        if (tail_size_ == sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, tail_, sizeof(word));
+            MixWord(word);
+            tail_size_ = 0;
+        }
+    }
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        MixWord(word);
+    }
+    std::memcpy(tail_ + tail_size_, data, size);
+    tail_size_ += size;
+}
+
+uint64_t SnapshotChecksum::Get() const {
+    SnapshotChecksum result = *this;
+    uint64_t word = 0;
+    std::memcpy(&word, tail_, tail_size_);
+    result.MixWord(word);
+    result.MixWord(length_);
+    return result.hash_;
+}
+
+void SnapshotChecksum::MixWord(uint64_t word) {
+    hash_ = (hash_ ^ word) * 1099511628211ull;
+    hash_ ^= hash_ >> 29;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path)
+    : path_(path)
+    , temporary_path_(path + ".tmp"s)
+    , output_(temporary_path_, std::ios::binary | std::ios::trunc)
+{
+    if (!output_) {
+        throw std::runtime_error("Cannot create snapshot file "s + temporary_path_);
+    }
+    // The header is rewritten with the real sizes once the payload is known
+    const SnapshotHeader header = {};
+    output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer_.reserve(WRITE_BUFFER_SIZE);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (!is_finished_) {
+        output_.close();
+        std::remove(temporary_path_.c_str());
+    }
+}
+
+void SnapshotWriter::WriteString(std::string_view text) {
+    Write(static_cast<uint32_t>(text.size()));
+    WriteBytes(text.data(), text.size());
+}
+
+void SnapshotWriter::Align(size_t alignment) {
+    while (payload_size_ % alignment != 0) {
+        Write('\0');
+    }
+}
+
+void SnapshotWriter::Finish() {
+    Flush();
+    SnapshotHeader header = {};
+    std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order_mark = SNAPSHOT_BYTE_ORDER_MARK;
+    header.payload_size = payload_size_;
+    header.checksum = checksum_.Get();
+    output_.seekp(0);
+    output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output_.close();
+    if (!output_) {
+        throw std::runtime_error("Cannot write snapshot file "s + temporary_path_);
+    }
+    ReplaceFile(temporary_path_, path_);
+    is_finished_ = true;
+}
+
+void SnapshotWriter::WriteBytes(const char* data, size_t size) {
+    if (buffer_.size() + size > WRITE_BUFFER_SIZE) {
+        Flush();
+    }
+    if (size > WRITE_BUFFER_SIZE) {
+        checksum_.Update(data, size);
+        output_.write(data, size);
+    }
+    else {
+        buffer_.insert(buffer_.end(), data, data + size);
+    }
+    payload_size_ += size;
+}
+
+void SnapshotWriter::Flush() {
+    checksum_.Update(buffer_.data(), buffer_.size());
+    output_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+SnapshotReader::SnapshotReader(const char* data, size_t size) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (!std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), header.magic)) {
+        throw std::runtime_error("File is not a search server snapshot"s);
+    }
+    if (header.byte_order_mark != SNAPSHOT_BYTE_ORDER_MARK) {
+        throw std::runtime_error("Snapshot was written with another byte order"s);
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version "s + std::to_string(header.version));
+    }
+    if (header.payload_size != size - sizeof(header)) {
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    data_ = data + sizeof(header);
+    size_ = size - sizeof(header);
+    SnapshotChecksum checksum;
+    checksum.Update(data_, size_);
+    if (checksum.Get() != header.checksum) {
+        throw std::runtime_error("Snapshot checksum mismatch"s);
+    }
+}
+
+void SnapshotReader::Align(size_t alignment) {
+    ReadBytes((alignment - pos_ % alignment) % alignment);
+}
+
+std::string_view SnapshotReader::ReadString() {
+    const uint32_t size = Read<uint32_t>();
+    return { ReadBytes(size), size };
+}
+
+bool SnapshotReader::IsEnd() const {
+    return pos_ == size_;
+}
+
+const char* SnapshotReader::ReadBytes(size_t size) {
+    if (size > size_ - pos_) {
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    const char* data = data_ + pos_;
+    pos_ += size;
+    return data;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Snapshot layout: a fixed header followed by the payload. The header holds
+// the magic, the format version, a byte order mark, the payload size and its
+// checksum. Numbers are stored in the byte order of the machine which wrote
+// the snapshot; the mark rejects files from a machine with another order.
+// The header takes a multiple of 8 bytes, so arrays aligned within the
+// payload stay aligned in a mapped file and can be read in place
+const uint32_t SNAPSHOT_VERSION = 3;
+
+// 64-bit hash of a byte stream, mixing it a machine word at a time
+class SnapshotChecksum {
+public:
+    void Update(const char* data, size_t size);
+
+    uint64_t Get() const;
+
+private:
+    uint64_t hash_ = 14695981039346656037ull;
+    uint64_t length_ = 0;
+    char tail_[sizeof(uint64_t)] = {};
+    size_t tail_size_ = 0;
+
+    void MixWord(uint64_t word);
+};
+
+// Writes the payload through a buffer into path + ".tmp" and fills in the
+// header on Finish(), which syncs the file and renames it over path. A server
+// loaded from the old file keeps reading its mapping, as the rename leaves
+// the old file alive until the mapping is closed. Without Finish() the
+// temporary file is removed and path stays as it was
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    ~SnapshotWriter();
+
+    template <typename T>
+    void Write(const T& value);
+
+    // Writes the values without their count
+    template <typename T>
+    void WriteArray(const std::vector<T>& values);
+
+    template <typename T>
+    void WriteArray(const T* values, size_t count);
+
+    // Pads the payload with zeros up to a multiple of alignment
+    void Align(size_t alignment);
+
+    void WriteString(std::string_view text);
+
+    void Finish();
+
+private:
+    std::string path_;
+    std::string temporary_path_;
+    std::ofstream output_;
+    bool is_finished_ = false;
+    std::vector<char> buffer_;
+    SnapshotChecksum checksum_;
+    uint64_t payload_size_ = 0;
+
+    void WriteBytes(const char* data, size_t size);
+
+    void Flush();
+};
+
+// Reads the payload of a snapshot held in memory; the constructor checks the
+// header and the checksum, and every read is bounds checked
+class SnapshotReader {
+public:
+    SnapshotReader(const char* data, size_t size);
+
+    template <typename T>
+    T Read();
+
+    template <typename T>
+    void ReadArray(std::vector<T>& values, size_t count);
+
+    // Returns the values in place instead of copying them; they live as long
+    // as the memory the reader was given
+    template <typename T>
+    const T* ReadArrayView(size_t count);
+
+    // Skips the padding written by SnapshotWriter::Align
+    void Align(size_t alignment);
+
+    std::string_view ReadString();
+
+    bool IsEnd() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+
+    const char* ReadBytes(size_t size);
+};
+
+template <typename T>
+void SnapshotWriter::Write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    WriteBytes(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void SnapshotWriter::WriteArray(const std::vector<T>& values) {
+    WriteArray(values.data(), values.size());
+}
+
+template <typename T>
+void SnapshotWriter::WriteArray(const T* values, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    WriteBytes(reinterpret_cast<const char*>(values), count * sizeof(T));
+}
+
+template <typename T>
+T SnapshotReader::Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, ReadBytes(sizeof(T)), sizeof(T));
+    return value;
+}
+
+template <typename T>
+void SnapshotReader::ReadArray(std::vector<T>& values, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (count > (size_ - pos_) / sizeof(T)) {
+        using namespace std::literals;
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    values.resize(count);
+    if (count > 0) {
+        std::memcpy(values.data(), ReadBytes(count * sizeof(T)), count * sizeof(T));
+    }
+}
+
+template <typename T>
+const T* SnapshotReader::ReadArrayView(size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    using namespace std::literals;
+    if (count > (size_ - pos_) / sizeof(T)) {
+        throw std::runtime_error("Snapshot is truncated"s);
+    }
+    const char* data = ReadBytes(count * sizeof(T));
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0) {
+        throw std::runtime_error("Snapshot array is misaligned"s);
+    }
+    return reinterpret_cast<const T*>(data);
+}
@@ -3,7 +3,12 @@
 
 std::vector<std::string_view> SplitIntoWords(const std::string_view text) {
     std::vector<std::string_view> words;
-    std::string_view word;
+    SplitIntoWords(text, words);
+    return words;
+}
+
+void SplitIntoWords(std::string_view text, std::vector<std::string_view>& words) {
+    words.clear();
     auto pos = text.find_first_not_of(" ");
     const auto pos_end = text.npos;
     while (pos != pos_end) {
@@ -11,7 +16,6 @@ std::vector<std::string_view> SplitIntoWords(const std::string_view text) {
         words.push_back(space == pos_end ? text.substr(pos) : text.substr(pos, space - pos));
         pos = text.find_first_not_of(" ", space);
     }
-    return words;
 }
 
 
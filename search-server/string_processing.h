@@ -8,6 +8,9 @@
 
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
 
+// Fills words reusing their memory
+void SplitIntoWords(std::string_view text, std::vector<std::string_view>& words);
+
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
     std::set<std::string, std::less<>> non_empty_strings;
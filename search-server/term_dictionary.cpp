@@ -0,0 +1,38 @@
+#include "term_dictionary.h"
+
+uint32_t TermDictionary::AddTerm(std::string_view word) {
+    const auto it = term_ids_.find(word);
+    if (it != term_ids_.end()) {
+        return it->second;
+    }
+    const std::string_view term = arena_.Store(word);
+    const uint32_t term_id = static_cast<uint32_t>(terms_.size());
+    terms_.push_back(term);
+    term_ids_.emplace(term, term_id);
+    return term_id;
+}
+
+std::optional<uint32_t> TermDictionary::FindTerm(std::string_view word) const {
+    const auto it = term_ids_.find(word);
+    if (it == term_ids_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::string_view TermDictionary::GetTerm(uint32_t term_id) const {
+    return terms_[term_id];
+}
+
+size_t TermDictionary::GetTermCount() const {
+    return terms_.size();
+}
+
+// A hash table node holds the next pointer, the key-value pair and the cached hash
+size_t TermDictionary::GetMemoryUsage() const {
+    using Node = std::pair<std::string_view, uint32_t>;
+    return arena_.GetMemoryUsage()
+        + terms_.capacity() * sizeof(std::string_view)
+        + term_ids_.bucket_count() * sizeof(void*)
+        + term_ids_.size() * (sizeof(Node) + sizeof(void*) + sizeof(size_t));
+}
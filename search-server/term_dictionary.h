@@ -0,0 +1,31 @@
+#pragma once
+
+#include "text_arena.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Interns words: every distinct word is stored once in an arena and gets a
+// dense id, so the index can refer to words by 32-bit integers
+class TermDictionary {
+public:
+    // Returns the id of the word, adding it to the dictionary if needed
+    uint32_t AddTerm(std::string_view word);
+
+    std::optional<uint32_t> FindTerm(std::string_view word) const;
+
+    std::string_view GetTerm(uint32_t term_id) const;
+
+    size_t GetTermCount() const;
+
+    // Approximate heap usage in bytes
+    size_t GetMemoryUsage() const;
+
+private:
+    TextArena arena_;
+    std::unordered_map<std::string_view, uint32_t> term_ids_;
+    std::vector<std::string_view> terms_;
+};
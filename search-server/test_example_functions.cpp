@@ -0,0 +1,1246 @@
+#include "test_example_functions.h"
+#include "concurrent_map.h"
+#include "concurrent_search_server.h"
+#include "corpus_file.h"
+#include "remove_duplicates.h"
+#include "sharded_search_server.h"
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+// Counted by the operator new and new[] below, for the calling thread only
+thread_local size_t allocation_count = 0;
+
+// The operators below go through these, so GCC does not pair a free() it
+// sees inlined with an operator new
+[[gnu::noinline]] void* AllocateCounted(std::size_t size) {
+    ++allocation_count;
+    if (void* pointer = std::malloc(size > 0 ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void FreeCounted(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+template <typename T, typename U>
+void AssertEqualImpl(const T& t, const U& u, const std::string& t_str, const std::string& u_str,
+    const std::string& file, const std::string& func, unsigned line, const std::string& hint) {
+    if (t != u) {
+        std::cerr << std::boolalpha;
+        std::cerr << file << "("s << line << "): "s << func << ": "s;
+        std::cerr << "ASSERT_EQUAL("s << t_str << ", "s << u_str << ") failed: "s;
+        std::cerr << t << " != "s << u << "."s;
+        if (!hint.empty()) {
+            std::cerr << " Hint: "s << hint;
+        }
+        std::cerr << std::endl;
+        std::abort();
+    }
+}
+
+void AssertImpl(bool value, const std::string& expr_str, const std::string& file, const std::string& func,
+    unsigned line, const std::string& hint) {
+    if (!value) {
+        std::cerr << file << "("s << line << "): "s << func << ": "s;
+        std::cerr << "ASSERT("s << expr_str << ") failed."s;
+        if (!hint.empty()) {
+            std::cerr << " Hint: "s << hint;
+        }
+        std::cerr << std::endl;
+        std::abort();
+    }
+}
+
+// Checks that the results are the same documents in the same order
+void AssertSameDocuments(const std::vector<Document>& documents, const std::vector<Document>& expected_documents,
+    const std::string& hint, const std::string& file, const std::string& func, unsigned line) {
+    AssertEqualImpl(documents.size(), expected_documents.size(), "documents.size()"s, "expected_documents.size()"s,
+        file, func, line, hint);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        AssertEqualImpl(documents[i].id, expected_documents[i].id, "documents[i].id"s, "expected_documents[i].id"s,
+            file, func, line, hint);
+        AssertEqualImpl(documents[i].rating, expected_documents[i].rating, "documents[i].rating"s,
+            "expected_documents[i].rating"s, file, func, line, hint);
+        AssertImpl(std::abs(documents[i].relevance - expected_documents[i].relevance) < RELEVANCE_EPSILON,
+            "documents[i].relevance == expected_documents[i].relevance"s, file, func, line, hint);
+    }
+}
+
+// Scores queries the plain way, over a map of all the live documents, to
+// check the segmented index against. Texts and queries have no stop words
+class ReferenceIndex {
+public:
+    void AddDocument(int document_id, const std::string& text, DocumentStatus status, int rating) {
+        Entry& entry = documents_[document_id];
+        entry = { {}, status, rating };
+        const std::vector<std::string_view> words = SplitIntoWords(text);
+        for (std::string_view word : words) {
+            entry.word_freqs[std::string(word)] += 1.0 / static_cast<double>(words.size());
+        }
+    }
+
+    void RemoveDocument(int document_id) {
+        documents_.erase(document_id);
+    }
+
+    std::vector<Document> FindTopDocuments(const std::string& query, DocumentStatus status,
+        size_t max_result_count) const {
+        std::set<std::string> plus_words;
+        std::set<std::string> minus_words;
+        for (std::string_view word : SplitIntoWords(query)) {
+            if (word[0] == '-') {
+                minus_words.emplace(word.substr(1));
+            }
+            else {
+                plus_words.emplace(word);
+            }
+        }
+        std::map<std::string, double> inverse_document_freqs;
+        for (const std::string& word : plus_words) {
+            const auto document_count = std::count_if(documents_.begin(), documents_.end(), [&](const auto& document) {
+                return document.second.word_freqs.count(word) > 0;
+                });
+            if (document_count > 0) {
+                inverse_document_freqs[word] = std::log(documents_.size() * 1.0 / document_count);
+            }
+        }
+        std::vector<Document> result;
+        for (const auto& [document_id, entry] : documents_) {
+            if (entry.status != status || std::any_of(minus_words.begin(), minus_words.end(),
+                [&](const std::string& word) { return entry.word_freqs.count(word) > 0; })) {
+                continue;
+            }
+            double relevance = 0.0;
+            bool is_matched = false;
+            for (const auto& [word, inverse_document_freq] : inverse_document_freqs) {
+                if (const auto it = entry.word_freqs.find(word); it != entry.word_freqs.end()) {
+                    relevance += it->second * inverse_document_freq;
+                    is_matched = true;
+                }
+            }
+            if (is_matched) {
+                result.push_back({ document_id, relevance, entry.rating });
+            }
+        }
+        std::sort(result.begin(), result.end(), IsMoreRelevant);
+        result.resize(std::min(result.size(), max_result_count));
+        return result;
+    }
+
+private:
+    struct Entry {
+        std::map<std::string, double> word_freqs;
+        DocumentStatus status;
+        int rating;
+    };
+
+    std::map<int, Entry> documents_;
+};
+
+template <typename TestFunc>
+void RunTestImpl(const TestFunc& func, const std::string& test_name) {
+    func();
+    std::cerr << test_name << " OK"s << std::endl;
+}
+
+} // namespace
+
+#define ASSERT_EQUAL(a, b) AssertEqualImpl((a), (b), #a, #b, __FILE__, __FUNCTION__, __LINE__, ""s)
+
+#define ASSERT_EQUAL_HINT(a, b, hint) AssertEqualImpl((a), (b), #a, #b, __FILE__, __FUNCTION__, __LINE__, (hint))
+
+#define ASSERT(expr) AssertImpl(!!(expr), #expr, __FILE__, __FUNCTION__, __LINE__, ""s)
+
+#define ASSERT_HINT(expr, hint) AssertImpl(!!(expr), #expr, __FILE__, __FUNCTION__, __LINE__, (hint))
+
+#define ASSERT_SAME_DOCUMENTS(a, b, hint) AssertSameDocuments((a), (b), (hint), __FILE__, __FUNCTION__, __LINE__)
+
+#define RUN_TEST(func) RunTestImpl(func, #func)
+
+void* operator new(std::size_t size) {
+    return AllocateCounted(size);
+}
+
+void* operator new[](std::size_t size) {
+    return AllocateCounted(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    FreeCounted(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    FreeCounted(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    FreeCounted(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    FreeCounted(pointer);
+}
+
+// Document 2 * k is "alpha", document 2 * k + 1 is "bravo". A pair is added
+// in one write and its bravo is removed before its alpha, so no published
+// generation may hold a bravo without its alpha
+void TestConcurrentSearchServerConsistency() {
+    const int writer_count = 2;
+    const int reader_count = 2;
+    const int pair_count = 2000;
+    const int kept_pair_count = 50;
+    ConcurrentSearchServer server(""s);
+    std::atomic<int> running_writer_count{ writer_count };
+    std::atomic<int> check_count{ 0 };
+
+    std::vector<std::thread> threads;
+    for (int writer = 0; writer < writer_count; ++writer) {
+        threads.emplace_back([&, writer] {
+            const int first_pair = writer * pair_count;
+            for (int k = first_pair; k < first_pair + pair_count; ++k) {
+                const std::string alpha = "alpha word"s + std::to_string(k);
+                const std::string bravo = "bravo word"s + std::to_string(k);
+                const std::vector<NewDocument> pair = {
+                    { 2 * k, alpha, DocumentStatus::ACTUAL, { 1 } },
+                    { 2 * k + 1, bravo, DocumentStatus::ACTUAL, { 2 } },
+                };
+                server.AddDocuments(std::execution::par, pair);
+                if (k - first_pair >= kept_pair_count) {
+                    server.RemoveDocument(2 * (k - kept_pair_count) + 1);
+                    server.RemoveDocument(2 * (k - kept_pair_count));
+                }
+                server.Publish();
+            }
+            --running_writer_count;
+            });
+    }
+    for (int reader = 0; reader < reader_count; ++reader) {
+        threads.emplace_back([&] {
+            do {
+                const std::shared_ptr<const SearchServer> snapshot = server.GetSnapshot();
+                const std::vector<int> document_ids(snapshot->begin(), snapshot->end());
+                ASSERT_EQUAL(static_cast<int>(document_ids.size()), snapshot->GetDocumentCount());
+                std::vector<int> sorted_ids = document_ids;
+                std::sort(sorted_ids.begin(), sorted_ids.end());
+                for (int document_id : sorted_ids) {
+                    if (document_id % 2 == 1) {
+                        ASSERT_HINT(std::binary_search(sorted_ids.begin(), sorted_ids.end(), document_id - 1),
+                            "bravo "s + std::to_string(document_id) + " without its alpha"s);
+                        const auto [words, status] = snapshot->MatchDocument("bravo alpha"s, document_id);
+                        ASSERT_EQUAL(words.size(), 1u);
+                        ASSERT_EQUAL(words[0], "bravo"sv);
+                    }
+                }
+                std::this_thread::yield();
+                ASSERT(std::equal(document_ids.begin(), document_ids.end(), snapshot->begin(), snapshot->end()));
+                ++check_count;
+            } while (running_writer_count > 0);
+            });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT(check_count > 0);
+    ASSERT_EQUAL(server.GetDocumentCount(), writer_count * kept_pair_count * 2);
+    for (int writer = 0; writer < writer_count; ++writer) {
+        const int k = writer * pair_count + pair_count - 1;
+        const std::vector<Document> documents = server.FindTopDocuments("word"s + std::to_string(k));
+        ASSERT_EQUAL(documents.size(), 2u);
+    }
+}
+
+// A reader holding the previous generation stops the next write until it
+// lets go, and a writer holding one itself gets an error instead of waiting
+// for itself forever
+void TestConcurrentSnapshotHeldAcrossWrite() {
+    {
+        ConcurrentSearchServer server(""s);
+        server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+        server.Publish();
+        std::shared_ptr<const SearchServer> snapshot = server.GetSnapshot();
+        server.AddDocument(2, "cat dog"s, DocumentStatus::ACTUAL, { 2 });
+        server.Publish();
+
+        std::atomic<bool> is_written{ false };
+        std::thread writer([&] {
+            server.AddDocument(3, "cat bird"s, DocumentStatus::ACTUAL, { 3 });
+            server.Publish();
+            is_written = true;
+            });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT(!is_written);
+        ASSERT_EQUAL(snapshot->GetDocumentCount(), 1);
+        ASSERT_EQUAL(snapshot->FindTopDocuments("cat"s).size(), 1u);
+        snapshot.reset();
+        writer.join();
+        ASSERT_EQUAL(server.GetDocumentCount(), 3);
+        ASSERT_EQUAL(server.FindTopDocuments("cat"s).size(), 3u);
+    }
+
+    ConcurrentSearchServer server(""s, DEFAULT_MAX_PENDING_WRITES, std::chrono::milliseconds(20));
+    server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.Publish();
+    std::shared_ptr<const SearchServer> snapshot = server.GetSnapshot();
+    server.AddDocument(2, "cat dog"s, DocumentStatus::ACTUAL, { 2 });
+    server.Publish();
+    bool is_thrown = false;
+    try {
+        server.AddDocument(3, "cat bird"s, DocumentStatus::ACTUAL, { 3 });
+    }
+    catch (const std::runtime_error&) {
+        is_thrown = true;
+    }
+    ASSERT(is_thrown);
+    snapshot.reset();
+    server.AddDocument(3, "cat bird"s, DocumentStatus::ACTUAL, { 3 });
+    server.Publish();
+    ASSERT_EQUAL(server.GetDocumentCount(), 3);
+    server.RemoveDocument(1);
+    server.Publish();
+    server.AddDocument(4, "cat fish"s, DocumentStatus::ACTUAL, { 4 });
+    server.Publish();
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s).size(), 3u);
+}
+
+// The queries run once to grow the context, and the cache fills up then.
+// Checks inside the counted loop would allocate, so they come after it
+void TestQueryContextAllocations() {
+    const int document_count = 10'000;
+    SearchServer search_server("and with"s);
+    for (int id = 0; id < document_count; ++id) {
+        const std::string text = "cat"s + std::to_string(id % 50) + " and dog"s + std::to_string(id % 7)
+            + " with collar"s + std::to_string(id % 3);
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 10 });
+    }
+    const std::vector<std::string> queries = {
+        "cat1 dog2"s, "dog3 collar1 -cat4"s, "cat7 cat7 and collar2"s, "dog0 -collar0"s, "unknown dog5"s,
+    };
+
+    for (const size_t cache_capacity : { 0, 100 }) {
+        search_server.SetResultCacheCapacity(cache_capacity);
+        for (const QueryEvaluation evaluation : { QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND }) {
+            SearchServer::QueryContext context;
+            for (const std::string& query : queries) {
+                search_server.FindTopDocuments(context, query, DocumentStatus::ACTUAL, MAX_RESULT_DOCUMENT_COUNT,
+                    evaluation);
+            }
+            const size_t first_allocation_count = allocation_count;
+            size_t result_count = 0;
+            for (int run = 0; run < 100; ++run) {
+                for (const std::string& query : queries) {
+                    result_count += search_server.FindTopDocuments(context, query, DocumentStatus::ACTUAL,
+                        MAX_RESULT_DOCUMENT_COUNT, evaluation).size();
+                }
+            }
+            const size_t query_allocation_count = allocation_count - first_allocation_count;
+            ASSERT_EQUAL_HINT(query_allocation_count, 0u, "cache capacity "s + std::to_string(cache_capacity));
+            ASSERT_EQUAL(result_count, 100u * MAX_RESULT_DOCUMENT_COUNT * queries.size());
+        }
+    }
+}
+
+// A missing id must throw out of MatchDocuments(par) instead of terminating
+// the process from inside the parallel algorithm
+void TestMatchDocumentsMissingId() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "white cat and collar"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "black dog"s, DocumentStatus::BANNED, { 2 });
+    const auto matches = search_server.MatchDocuments(std::execution::par, "cat dog -collar"s, { 1, 2 });
+    ASSERT_EQUAL(matches.size(), 2u);
+    ASSERT(std::get<0>(matches[0]).empty());
+    ASSERT_EQUAL(std::get<0>(matches[1]).size(), 1u);
+    ASSERT(std::get<1>(matches[1]) == DocumentStatus::BANNED);
+
+    bool is_thrown = false;
+    try {
+        search_server.MatchDocuments(std::execution::par, "cat"s, { 1, 3, 2 });
+    }
+    catch (const std::out_of_range&) {
+        is_thrown = true;
+    }
+    ASSERT(is_thrown);
+}
+
+void TestTokenizerStopWords() {
+    const Tokenizer tokenizer({ "a"s, "in"s, "the"s });
+    ASSERT(tokenizer.IsStopWord("in"sv));
+    ASSERT(!tokenizer.IsStopWord("on"sv));
+    ASSERT(!tokenizer.IsStopWord(""sv));
+    ASSERT(!Tokenizer().IsStopWord(""sv));
+
+    std::vector<std::string_view> words;
+    ASSERT(!tokenizer.SplitIntoWordsNoStop("  the cat in  a hat "sv, words));
+    ASSERT_EQUAL(words.size(), 2u);
+    ASSERT_EQUAL(words[0], "cat"sv);
+    ASSERT_EQUAL(words[1], "hat"sv);
+}
+
+// The corpus is large enough for its batch to be parsed in several parts,
+// and the malformed line is in the last one
+void TestCorpusFileMalformedLine() {
+    const int line_count = 5000;
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_test.corpus").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (int id = 1; id < line_count; ++id) {
+            out << id << "\tACTUAL\t1 2\tcat dog bird fish horse cow sheep goat pig duck goose hen\n"s;
+        }
+        out << line_count << "\tUNKNOWN\t\tfish\n"s;
+    }
+    CorpusFile corpus(path);
+    std::vector<NewDocument> documents;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string error;
+        try {
+            corpus.ReadBatch(documents);
+        }
+        catch (const std::invalid_argument& e) {
+            error = e.what();
+        }
+        ASSERT_EQUAL(error, "Corpus line "s + std::to_string(line_count) + " is malformed"s);
+    }
+    std::filesystem::remove(path);
+}
+
+// A rejected duplicate adds no words to the dictionary and keeps the cached
+// results, alone and in a batch, while a batch may still reject a document
+// duplicating another one of the same batch
+void TestRejectedDuplicateChangesNothing() {
+    SearchServer search_server(""s);
+    search_server.SetResultCacheCapacity(10);
+    std::vector<std::pair<int, int>> duplicates;
+    search_server.SetDuplicatePolicy(DuplicatePolicy::REJECT, [&](int document_id, int original_document_id) {
+        duplicates.emplace_back(document_id, original_document_id);
+        });
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.FindTopDocuments("cat"s);
+    const size_t dictionary_size = search_server.GetMemoryUsage().dictionary;
+
+    search_server.AddDocument(2, "dog cat cat"s, DocumentStatus::ACTUAL, { 2 });
+    const std::string texts[] = { "cat dog dog"s, "dog cat"s, "bird cat"s, "cat bird"s };
+    search_server.AddDocuments(std::execution::par, {
+        { 3, texts[0], DocumentStatus::ACTUAL, { 3 } },
+        { 4, texts[1], DocumentStatus::ACTUAL, { 4 } },
+        });
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 1);
+    ASSERT_EQUAL(search_server.GetMemoryUsage().dictionary, dictionary_size);
+    search_server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 1u);
+
+    search_server.AddDocuments(std::execution::par, {
+        { 5, texts[2], DocumentStatus::ACTUAL, { 5 } },
+        { 6, texts[3], DocumentStatus::ACTUAL, { 6 } },
+        });
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 2);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s).size(), 2u);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 1u);
+    const std::vector<std::pair<int, int>> expected_duplicates = { { 2, 1 }, { 3, 1 }, { 4, 1 }, { 6, 5 } };
+    ASSERT(duplicates == expected_duplicates);
+}
+
+// A dozen words over 20000 documents make most relevances tie, and small
+// ratings make many ties go down to the id. The documents fill sealed
+// segments of packed blocks as well as the mutable one, and some of them
+// are removed
+void TestWandMatchesExhaustive() {
+    const int document_count = 20'000;
+    const std::vector<std::string> words = {
+        "cat"s, "dog"s, "bird"s, "fish"s, "horse"s, "cow"s, "sheep"s, "goat"s, "pig"s, "duck"s, "goose"s, "hen"s,
+    };
+    std::mt19937 generator(4);
+    const auto pick_word = [&] {
+        const double x = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+        return words[static_cast<size_t>(x * x * static_cast<double>(words.size()))];
+    };
+    SearchServer search_server("and"s);
+    for (int id = 0; id < document_count; ++id) {
+        std::string text = pick_word();
+        for (int i = std::uniform_int_distribution<int>(0, 5)(generator); i > 0; --i) {
+            text += " "s + pick_word();
+        }
+        const DocumentStatus status = id % 10 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, { std::uniform_int_distribution<int>(-2, 2)(generator) });
+    }
+    for (int id = 0; id < document_count; id += 7) {
+        search_server.RemoveDocument(id);
+    }
+
+    for (int query_index = 0; query_index < 300; ++query_index) {
+        std::string query = pick_word();
+        for (int i = std::uniform_int_distribution<int>(0, 3)(generator); i > 0; --i) {
+            query += " "s + pick_word();
+        }
+        if (query_index % 3 == 0) {
+            query += " -"s + pick_word();
+        }
+        for (const size_t max_result_count : { 1, 5, 50 }) {
+            const std::string hint = query + ", "s + std::to_string(max_result_count) + " results"s;
+            ASSERT_SAME_DOCUMENTS(
+                search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, max_result_count, QueryEvaluation::WAND),
+                search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, max_result_count,
+                    QueryEvaluation::EXHAUSTIVE), hint);
+            const DocumentFilter filter{ std::nullopt, 0, 1 };
+            ASSERT_SAME_DOCUMENTS(
+                search_server.FindTopDocuments(query, filter, max_result_count, QueryEvaluation::WAND),
+                search_server.FindTopDocuments(query, filter, max_result_count, QueryEvaluation::EXHAUSTIVE), hint);
+            const auto predicate = [](int document_id, DocumentStatus, int) { return document_id % 3 == 0; };
+            ASSERT_SAME_DOCUMENTS(
+                search_server.FindTopDocuments(query, predicate, max_result_count, QueryEvaluation::WAND),
+                search_server.FindTopDocuments(query, predicate, max_result_count, QueryEvaluation::EXHAUSTIVE), hint);
+        }
+    }
+}
+
+// The index has sealed segments, the mutable one and removed documents. The
+// loaded server reads its postings from the file while a save replaces it
+void TestSnapshotRoundTrip() {
+    const std::string path = (std::filesystem::temp_directory_path() / "search_server_test.snapshot").string();
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 10'000; ++id) {
+        const std::string text = "cat"s + std::to_string(id % 50) + " and dog"s + std::to_string(id % 7);
+        search_server.AddDocument(id, text, static_cast<DocumentStatus>(id % 3), { id % 10 });
+    }
+    for (int id = 0; id < 10'000; id += 11) {
+        search_server.RemoveDocument(id);
+    }
+    const std::vector<std::string> queries = { "cat1 dog2"s, "dog3 -cat10"s, "cat7 cat8 and"s, "unknown"s };
+    const auto assert_same_index = [&](const SearchServer& loaded_server, const SearchServer& expected_server) {
+        ASSERT_EQUAL(loaded_server.GetDocumentCount(), expected_server.GetDocumentCount());
+        ASSERT(std::equal(loaded_server.begin(), loaded_server.end(), expected_server.begin(), expected_server.end()));
+        for (const std::string& query : queries) {
+            for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                ASSERT_SAME_DOCUMENTS(loaded_server.FindTopDocuments(query, status, 20),
+                    expected_server.FindTopDocuments(query, status, 20), query);
+            }
+        }
+        ASSERT(loaded_server.MatchDocument("cat5 dog5"s, 5) == expected_server.MatchDocument("cat5 dog5"s, 5));
+    };
+
+    search_server.SaveSnapshot(path);
+    SearchServer loaded_server = SearchServer::LoadSnapshot(path);
+    assert_same_index(loaded_server, search_server);
+
+    loaded_server.AddDocument(10'000, "cat1 dog2 bird"s, DocumentStatus::ACTUAL, { 10 });
+    loaded_server.SaveSnapshot(path);
+    ASSERT_EQUAL(loaded_server.FindTopDocuments("bird"s).front().id, 10'000);
+    search_server.AddDocument(10'000, "cat1 dog2 bird"s, DocumentStatus::ACTUAL, { 10 });
+    assert_same_index(loaded_server, search_server);
+    assert_same_index(SearchServer::LoadSnapshot(path), search_server);
+    ASSERT(!std::filesystem::exists(path + ".tmp"s));
+
+    std::string data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    const auto assert_rejected = [&](const std::string& bad_data, const std::string& hint) {
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out << bad_data;
+        }
+        bool is_thrown = false;
+        try {
+            SearchServer::LoadSnapshot(path);
+        }
+        catch (const std::runtime_error&) {
+            is_thrown = true;
+        }
+        ASSERT_HINT(is_thrown, hint);
+    };
+    assert_rejected(data.substr(0, data.size() - 1), "truncated by a byte"s);
+    assert_rejected(data.substr(0, 16), "truncated inside the header"s);
+    assert_rejected(""s, "empty"s);
+    std::string corrupted_data = data;
+    corrupted_data[corrupted_data.size() / 2] ^= 0x10;
+    assert_rejected(corrupted_data, "corrupted payload"s);
+    std::filesystem::remove(path);
+}
+
+// Ids below 4096 are in a sealed segment and the others in the mutable one.
+// Removed documents must leave results, counts and IDF at once, and Compact
+// must not change the results while it reclaims their postings
+void TestRemoveDocumentTombstones() {
+    const int document_count = 6000;
+    SearchServer search_server(""s);
+    ReferenceIndex reference;
+    const auto add_document = [&](int id, const std::string& text) {
+        const DocumentStatus status = id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, { id % 4 });
+        reference.AddDocument(id, text, status, id % 4);
+    };
+    for (int id = 0; id < document_count; ++id) {
+        add_document(id, "cat"s + std::to_string(id % 40) + " dog"s + std::to_string(id % 9) + " bird"s);
+    }
+    const auto remove_document = [&](int id) {
+        search_server.RemoveDocument(id);
+        reference.RemoveDocument(id);
+    };
+    const std::vector<std::string> queries = { "cat1 dog1"s, "cat3 -dog3"s, "bird cat7"s, "dog8 cat0 -cat8"s };
+    const auto assert_same_results = [&](const std::string& hint) {
+        ASSERT_EQUAL_HINT(search_server.GetDocumentCount(), static_cast<int>(std::distance(search_server.begin(),
+            search_server.end())), hint);
+        for (const std::string& query : queries) {
+            for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments(query, status, 30),
+                    reference.FindTopDocuments(query, status, 30), hint + ", "s + query);
+            }
+        }
+    };
+    assert_same_results("before removal"s);
+
+    const int sealed_id = search_server.FindTopDocuments("cat1 dog1"s).front().id;
+    ASSERT(sealed_id < 4096);
+    remove_document(sealed_id);
+    remove_document(5001);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), document_count - 2);
+    for (const Document& document : search_server.FindTopDocuments("cat1 dog1"s, DocumentStatus::ACTUAL, 1000)) {
+        ASSERT(document.id != sealed_id && document.id != 5001);
+    }
+    bool is_thrown = false;
+    try {
+        search_server.MatchDocument("cat1"s, sealed_id);
+    }
+    catch (const std::out_of_range&) {
+        is_thrown = true;
+    }
+    ASSERT(is_thrown);
+    assert_same_results("after removing a sealed and a mutable document"s);
+
+    for (int id = 0; id < document_count; id += 3) {
+        if (id != sealed_id && id != 5001) {
+            remove_document(id);
+        }
+    }
+    add_document(sealed_id, "cat1 dog1 bird horse"s);
+    add_document(3, "cat3 fish"s);
+    assert_same_results("after removing a third and adding two ids again"s);
+    const size_t remaining_count = search_server.Compact(100);
+    ASSERT(remaining_count > 0);
+    assert_same_results("after a partial Compact"s);
+    ASSERT_EQUAL(search_server.Compact(), 0u);
+    assert_same_results("after Compact"s);
+    ASSERT_EQUAL(search_server.Compact(std::execution::par), 0u);
+}
+
+// The mutable segment is sealed at 4096 documents and four sealed segments
+// merge into one at 16384. Removed documents of the mutable segment are
+// dropped when it is sealed and the ones of sealed segments by the merge,
+// which Compact(0) reports without rewriting anything
+void TestSegmentMerges() {
+    SearchServer search_server(""s);
+    ReferenceIndex reference;
+    const auto make_text = [](int id) {
+        return "cat"s + std::to_string(id % 30) + " dog"s + std::to_string(id % 11) + " bird"s
+            + std::to_string(id % 4097);
+    };
+    const auto add_document = [&](int id) {
+        const std::string text = make_text(id);
+        const DocumentStatus status = id % 6 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, { id % 5 });
+        reference.AddDocument(id, text, status, id % 5);
+    };
+    const auto remove_document = [&](int id) {
+        search_server.RemoveDocument(id);
+        reference.RemoveDocument(id);
+    };
+    const std::vector<std::string> queries = { "cat1 dog1"s, "cat2 -dog2"s, "bird7 cat7 dog7"s, "bird4096 dog0"s };
+    const auto assert_same_results = [&](int last_id) {
+        const std::string hint = "up to id "s + std::to_string(last_id);
+        ASSERT_EQUAL_HINT(search_server.GetDocumentCount(), static_cast<int>(std::distance(search_server.begin(),
+            search_server.end())), hint);
+        for (const std::string& query : queries) {
+            for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT }) {
+                ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments(query, status, 20),
+                    reference.FindTopDocuments(query, status, 20), hint + ", "s + query);
+            }
+        }
+    };
+
+    const std::set<int> checked_ids = { 4094, 4095, 4096, 8191, 8192, 12288, 16382, 16383, 16384 };
+    for (int id = 0; id < 16500; ++id) {
+        add_document(id);
+        if (id == 4000) {
+            remove_document(100);
+            remove_document(200);
+            ASSERT_EQUAL(search_server.Compact(0), 2u);
+        }
+        if (id == 4200) {
+            ASSERT_EQUAL(search_server.Compact(0), 0u);
+        }
+        if (id == 5000) {
+            remove_document(10);
+            remove_document(4500);
+            remove_document(9);
+            ASSERT_EQUAL(search_server.Compact(0), 3u);
+        }
+        if (id == 16000) {
+            ASSERT_EQUAL(search_server.Compact(0), 2u);
+        }
+        if (checked_ids.count(id) > 0) {
+            assert_same_results(id);
+        }
+    }
+    ASSERT_EQUAL(search_server.Compact(0), 0u);
+
+    std::vector<std::string> batch_texts;
+    std::vector<NewDocument> batch;
+    for (int id = 16500; id < 21500; ++id) {
+        batch_texts.push_back(make_text(id));
+    }
+    for (int id = 16500; id < 21500; ++id) {
+        const DocumentStatus status = id % 6 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL;
+        batch.push_back({ id, batch_texts[id - 16500], status, { id % 5 } });
+        reference.AddDocument(id, batch_texts[id - 16500], status, id % 5);
+    }
+    search_server.AddDocuments(std::execution::par, batch);
+    assert_same_results(21499);
+}
+
+// List sizes around the 4 lanes of a block, the 64 postings of a block and
+// the tails after full blocks, with gaps of width 0 and of many bits and with
+// codes in long runs and changing on every posting
+void TestPostingCodecRoundTrip() {
+    std::mt19937 generator(7);
+    std::vector<float> freq_table(300);
+    for (size_t i = 0; i < freq_table.size(); ++i) {
+        freq_table[i] = 0.5f + static_cast<float>(i) / 64.0f;
+    }
+    const std::vector<size_t> sizes = { 1, 3, 4, 5, 63, 64, 65, 127, 128, 129, 200 };
+    for (const size_t size : sizes) {
+        for (int gap_kind = 0; gap_kind < 3; ++gap_kind) {
+            for (int code_kind = 0; code_kind < 3; ++code_kind) {
+                const std::string hint = "size "s + std::to_string(size) + ", gaps "s + std::to_string(gap_kind)
+                    + ", codes "s + std::to_string(code_kind);
+                const uint32_t max_gap = gap_kind == 0 ? 0 : gap_kind == 1 ? 6 : (1u << 23);
+                std::vector<int> ids;
+                std::vector<uint32_t> freq_codes;
+                int id = gap_kind == 2 ? 1000000 : 0;
+                for (size_t i = 0; i < size; ++i) {
+                    id += static_cast<int>(std::uniform_int_distribution<uint32_t>(0, max_gap)(generator)) + (i > 0);
+                    ids.push_back(id);
+                    if (code_kind == 0) {
+                        freq_codes.push_back(3);
+                    } else if (code_kind == 1) {
+                        freq_codes.push_back(static_cast<uint32_t>(i / 10 % 2 == 0 ? 0 : freq_table.size() - 1));
+                    } else {
+                        freq_codes.push_back(std::uniform_int_distribution<uint32_t>(0, freq_table.size() - 1)(generator));
+                    }
+                }
+                std::vector<PackedBlock> blocks;
+                std::vector<uint8_t> data;
+                PackPostings(ids, freq_codes, freq_table, blocks, data);
+                ASSERT_EQUAL_HINT(blocks.size(), size / POSTING_BLOCK_SIZE, hint);
+                float max_term_freq = 0.0f;
+                for (const uint32_t freq_code : freq_codes) {
+                    max_term_freq = std::max(max_term_freq, freq_table[freq_code]);
+                }
+                const PackedPostings postings = { blocks.data(), data.data(), freq_table.data(), size, max_term_freq };
+
+                std::array<int, POSTING_BLOCK_SIZE> block_ids;
+                std::array<uint32_t, POSTING_BLOCK_SIZE> block_codes;
+                for (size_t block = 0; block * POSTING_BLOCK_SIZE < size; ++block) {
+                    const size_t begin = block * POSTING_BLOCK_SIZE;
+                    const size_t count = std::min(POSTING_BLOCK_SIZE, size - begin);
+                    ASSERT_EQUAL_HINT(UnpackBlockIds(postings, block, block_ids.data()), count, hint);
+                    ASSERT_EQUAL_HINT(UnpackBlockFreqCodes(postings, block, block_codes.data()), count, hint);
+                    for (size_t i = 0; i < count; ++i) {
+                        ASSERT_EQUAL_HINT(block_ids[i], ids[begin + i], hint);
+                        ASSERT_EQUAL_HINT(block_codes[i], freq_codes[begin + i], hint);
+                    }
+                }
+
+                PostingList::Cursor cursor(postings);
+                for (size_t i = 0; i < size; ++i, cursor.Next()) {
+                    ASSERT_HINT(!cursor.IsEnd(), hint);
+                    ASSERT_EQUAL_HINT(cursor.GetDocumentId(), ids[i], hint);
+                    ASSERT_EQUAL_HINT(cursor.GetTermFreq(), freq_table[freq_codes[i]], hint);
+                }
+                ASSERT_HINT(cursor.IsEnd(), hint);
+
+                PostingList::Cursor skipping_cursor(postings);
+                for (size_t i = 0; i < size; i += 1 + i % 37) {
+                    const int target = ids[i] + (i % 2 == 0 ? 0 : 1);
+                    skipping_cursor.SkipTo(target);
+                    const auto expected = std::lower_bound(ids.begin(), ids.end(), target);
+                    if (expected == ids.end()) {
+                        ASSERT_HINT(skipping_cursor.IsEnd(), hint);
+                        break;
+                    }
+                    ASSERT_HINT(!skipping_cursor.IsEnd(), hint);
+                    ASSERT_EQUAL_HINT(skipping_cursor.GetDocumentId(), *expected, hint);
+                    ASSERT_EQUAL_HINT(skipping_cursor.GetTermFreq(),
+                        freq_table[freq_codes[expected - ids.begin()]], hint);
+                }
+            }
+        }
+    }
+}
+
+// Words of different document frequencies land in different shards, so the
+// shards score right only with the IDF of the whole index
+void TestShardedMatchesUnsharded() {
+    SearchServer search_server("and in"s);
+    ShardedSearchServer sharded_server("and in"s, 3);
+    for (int id = 0; id < 3000; ++id) {
+        const std::string text = "cat"s + std::to_string(id % 40) + " and dog"s + std::to_string(id % 13)
+            + " in bird"s + std::to_string(id % 997) + (id % 250 == 0 ? " rare"s : ""s);
+        const DocumentStatus status = static_cast<DocumentStatus>(id % 4);
+        search_server.AddDocument(id, text, status, { id % 7, -(id % 3) });
+        sharded_server.AddDocument(id, text, status, { id % 7, -(id % 3) });
+    }
+    for (int id = 0; id < 3000; id += 17) {
+        search_server.RemoveDocument(id);
+        sharded_server.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(sharded_server.GetDocumentCount(), search_server.GetDocumentCount());
+
+    const std::vector<std::string> queries = { "rare"s, "rare cat3 -dog4"s, "bird5 bird6 and cat5"s,
+        "dog1 -cat1 in"s, "unknown cat0"s, "-cat2 dog2"s };
+    const auto predicate = [](int document_id, DocumentStatus, int rating) {
+        return document_id % 5 != 0 && rating > 0;
+    };
+    for (const std::string& query : queries) {
+        for (const QueryEvaluation evaluation : { QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND }) {
+            const std::string hint = query + (evaluation == QueryEvaluation::WAND ? ", WAND"s : ""s);
+            ASSERT_SAME_DOCUMENTS(sharded_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 10, evaluation),
+                search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 10, evaluation), hint);
+            ASSERT_SAME_DOCUMENTS(sharded_server.FindTopDocuments(query, DocumentStatus::BANNED, 7, evaluation),
+                search_server.FindTopDocuments(query, DocumentStatus::BANNED, 7, evaluation), hint);
+            ASSERT_SAME_DOCUMENTS(sharded_server.FindTopDocuments(query, predicate, 20, evaluation),
+                search_server.FindTopDocuments(query, predicate, 20, evaluation), hint);
+        }
+    }
+
+    bool is_invalid_query_rejected = false;
+    try {
+        sharded_server.FindTopDocuments("cat1 --dog1"s);
+    }
+    catch (const std::invalid_argument&) {
+        is_invalid_query_rejected = true;
+    }
+    ASSERT(is_invalid_query_rejected);
+    bool is_predicate_error_rethrown = false;
+    try {
+        sharded_server.FindTopDocuments("cat1"s, [](int, DocumentStatus, int) -> bool {
+            throw std::runtime_error("predicate"s);
+            });
+    }
+    catch (const std::runtime_error&) {
+        is_predicate_error_rethrown = true;
+    }
+    ASSERT(is_predicate_error_rethrown);
+}
+
+// A batch with an id already in one shard adds nothing to any shard, and the
+// same batch without that id is then added whole
+void TestShardedAddDocumentsRollback() {
+    ShardedSearchServer sharded_server(""s, 4);
+    for (int id = 0; id < 100; ++id) {
+        sharded_server.AddDocument(id, "cat dog"s + std::to_string(id % 5), DocumentStatus::ACTUAL, { id % 3 });
+    }
+    const std::vector<Document> expected_documents = sharded_server.FindTopDocuments("cat dog1 new"s);
+
+    std::vector<std::string> texts;
+    for (int id = 100; id < 300; ++id) {
+        texts.push_back("new cat"s + std::to_string(id));
+    }
+    std::vector<NewDocument> batch;
+    for (int id = 100; id < 300; ++id) {
+        batch.push_back({ id, texts[id - 100], DocumentStatus::ACTUAL, { 1 } });
+    }
+    batch.push_back({ 42, "new"s, DocumentStatus::ACTUAL, { 1 } });
+    bool is_batch_rejected = false;
+    try {
+        sharded_server.AddDocuments(std::execution::par, batch);
+    }
+    catch (const std::invalid_argument&) {
+        is_batch_rejected = true;
+    }
+    ASSERT(is_batch_rejected);
+    ASSERT_EQUAL(sharded_server.GetDocumentCount(), 100);
+    ASSERT_SAME_DOCUMENTS(sharded_server.FindTopDocuments("cat dog1 new"s), expected_documents, "after rollback"s);
+    ASSERT(sharded_server.FindTopDocuments("new"s).empty());
+
+    batch.pop_back();
+    sharded_server.AddDocuments(std::execution::par, batch);
+    ASSERT_EQUAL(sharded_server.GetDocumentCount(), 300);
+    ASSERT_EQUAL(sharded_server.FindTopDocuments("new"s, DocumentStatus::ACTUAL, 1000).size(), 200u);
+}
+
+// Ids run dense, sparse and across the multiples of the 16384 ids a batch
+// scores together, so windows are sorted both ways and postings fall on both
+// sides of a window end. The queries are enough for several parallel batches
+void TestBatchMatchesSingleQueries() {
+    SearchServer search_server("and"s);
+    std::vector<int> ids;
+    for (int id = 0; id < 6000; ++id) {
+        ids.push_back(id);
+    }
+    for (const int boundary : { 16384, 32768, 49152 }) {
+        for (int id = boundary - 300; id < boundary + 300; ++id) {
+            ids.push_back(id);
+        }
+    }
+    for (int id = 70000; id < 75000; id += 2) {
+        ids.push_back(id);
+    }
+    for (const int id : ids) {
+        std::string text = "w"s + std::to_string(id % 5) + " and v"s + std::to_string(id % 17) + " u"s
+            + std::to_string(id % 101);
+        if (id % 16384 == 0 || id % 16384 == 16383 || id % 16384 == 1) {
+            text += " edge"s;
+        }
+        search_server.AddDocument(id, text, static_cast<DocumentStatus>(id % 3 == 0), { id % 9 - 4 });
+    }
+    for (int id = 0; id < 6000; id += 13) {
+        search_server.RemoveDocument(id);
+    }
+
+    std::mt19937 generator(14);
+    const auto random_word = [&generator]() {
+        switch (std::uniform_int_distribution<int>(0, 5)(generator)) {
+        case 0: return "w"s + std::to_string(std::uniform_int_distribution<int>(0, 4)(generator));
+        case 1: return "v"s + std::to_string(std::uniform_int_distribution<int>(0, 16)(generator));
+        case 2: return "u"s + std::to_string(std::uniform_int_distribution<int>(0, 100)(generator));
+        case 3: return "edge"s;
+        case 4: return "and"s;
+        default: return "unknown"s;
+        }
+    };
+    std::vector<std::string> queries = { "edge"s, "edge -w0"s, "-edge"s, "u7 u7 -u7"s };
+    while (queries.size() < 600) {
+        std::string query;
+        const int word_count = std::uniform_int_distribution<int>(1, 4)(generator);
+        for (int i = 0; i < word_count; ++i) {
+            query += (std::uniform_int_distribution<int>(0, 4)(generator) == 0 ? " -"s : " "s) + random_word();
+        }
+        queries.push_back(query);
+    }
+
+    for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT }) {
+        const std::vector<std::vector<Document>> results = search_server.FindTopDocumentsBatch(queries, status, 7);
+        const std::vector<std::vector<Document>> par_results =
+            search_server.FindTopDocumentsBatch(std::execution::par, queries, status, 7);
+        ASSERT_EQUAL(results.size(), queries.size());
+        ASSERT_EQUAL(par_results.size(), queries.size());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const std::vector<Document> expected_documents = search_server.FindTopDocuments(queries[i], status, 7);
+            ASSERT_SAME_DOCUMENTS(results[i], expected_documents, queries[i]);
+            ASSERT_SAME_DOCUMENTS(par_results[i], expected_documents, "par"s + queries[i]);
+        }
+    }
+}
+
+// A write bumps the generation of the index, so the next query misses the
+// cache and sees the added or removed document
+void TestResultCacheInvalidation() {
+    SearchServer search_server(""s);
+    search_server.SetResultCacheCapacity(64);
+    for (int id = 0; id < 20; ++id) {
+        search_server.AddDocument(id, "cat dog"s + std::to_string(id % 4), DocumentStatus::ACTUAL, { id });
+    }
+    const auto find_ids = [&search_server]() {
+        std::vector<int> ids;
+        for (const Document& document : search_server.FindTopDocuments("cat dog1"s)) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    const std::vector<int> first_ids = find_ids();
+    ASSERT_EQUAL(search_server.GetResultCacheStats().misses, 1u);
+    ASSERT(find_ids() == first_ids);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 1u);
+
+    search_server.AddDocument(100, "dog1"s, DocumentStatus::ACTUAL, { 0 });
+    const std::vector<int> added_ids = find_ids();
+    ASSERT_EQUAL(search_server.GetResultCacheStats().misses, 2u);
+    ASSERT_EQUAL(added_ids.front(), 100);
+    ASSERT(find_ids() == added_ids);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 2u);
+
+    search_server.RemoveDocument(100);
+    ASSERT(find_ids() == first_ids);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().misses, 3u);
+    ASSERT(find_ids() == first_ids);
+    ASSERT_EQUAL(search_server.GetResultCacheStats().hits, 3u);
+}
+
+// A cache of capacity 32 keeps 2 keys in each of its 16 buckets. A third key
+// evicts the least recently used one of its own bucket and nothing elsewhere
+void TestResultCacheBucketEviction() {
+    const size_t bucket_count = 16;
+    std::vector<std::vector<ResultCacheKey>> bucket_keys(bucket_count);
+    for (uint32_t term_id = 0; bucket_keys[0].size() < 3 || bucket_keys[1].size() < 2; ++term_id) {
+        ResultCacheKey key;
+        key.plus_words = { term_id };
+        key.max_result_count = 5;
+        bucket_keys[ResultCacheKeyHasher{}(key) % bucket_count].push_back(key);
+    }
+    const auto make_documents = [](int id) {
+        return std::vector<Document>{ Document(id, 1.0, 0) };
+    };
+
+    ResultCache cache(32);
+    std::vector<Document> documents;
+    const std::vector<ResultCacheKey>& keys = bucket_keys[0];
+    const std::vector<ResultCacheKey>& other_keys = bucket_keys[1];
+    cache.Insert(other_keys[0], 1, make_documents(10));
+    cache.Insert(other_keys[1], 1, make_documents(11));
+    cache.Insert(keys[0], 1, make_documents(0));
+    cache.Insert(keys[1], 1, make_documents(1));
+    ASSERT(cache.Find(keys[0], 1, documents));
+    ASSERT_EQUAL(documents.front().id, 0);
+    ASSERT(!cache.Find(keys[0], 2, documents));
+    cache.Insert(keys[2], 1, make_documents(2));
+    ASSERT_EQUAL(cache.GetStats().evictions, 1u);
+
+    ASSERT(!cache.Find(keys[1], 1, documents));
+    ASSERT(cache.Find(keys[0], 1, documents));
+    ASSERT(cache.Find(keys[2], 1, documents));
+    ASSERT_EQUAL(documents.front().id, 2);
+    ASSERT(cache.Find(other_keys[0], 1, documents));
+    ASSERT_EQUAL(documents.front().id, 10);
+    ASSERT(cache.Find(other_keys[1], 1, documents));
+    ASSERT_EQUAL(documents.front().id, 11);
+    ASSERT_EQUAL(cache.GetStats().evictions, 1u);
+}
+
+// With a staleness of 1/4 the logs of the counts lag the ingestion, so IDF
+// is off by less than 2 * log(4/3) but not exact; setting 0 makes it exact
+// again and drops the cached results scored with the stale one
+void TestIdfStaleness() {
+    SearchServer search_server(""s);
+    ReferenceIndex reference;
+    search_server.SetMaxIdfStaleness(0.25);
+    search_server.SetResultCacheCapacity(16);
+    const auto add_document = [&](int id) {
+        const std::string text = "common rare"s + std::to_string(id % 50) + " word"s + std::to_string(id % 7);
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 4 });
+        reference.AddDocument(id, text, DocumentStatus::ACTUAL, id % 4);
+    };
+    const std::vector<std::string> queries = { "rare3"s, "word5"s, "rare49"s };
+    const double max_error = 2.0 * std::log(4.0 / 3.0) / 3.0;
+    const auto assert_stale_results = [&](const std::string& hint) {
+        bool is_any_stale = false;
+        for (const std::string& query : queries) {
+            const std::vector<Document> documents = search_server.FindTopDocuments(query);
+            const std::vector<Document> expected_documents = reference.FindTopDocuments(query, DocumentStatus::ACTUAL, 5);
+            ASSERT_EQUAL_HINT(documents.size(), expected_documents.size(), hint + ", "s + query);
+            for (size_t i = 0; i < documents.size(); ++i) {
+                ASSERT_EQUAL_HINT(documents[i].id, expected_documents[i].id, hint + ", "s + query);
+                const double error = std::abs(documents[i].relevance - expected_documents[i].relevance);
+                ASSERT_HINT(error < max_error, hint + ", "s + query);
+                is_any_stale = is_any_stale || error >= RELEVANCE_EPSILON;
+            }
+        }
+        ASSERT_HINT(is_any_stale, hint);
+    };
+    for (int id = 0; id < 2000; ++id) {
+        add_document(id);
+    }
+    assert_stale_results("after adding"s);
+    for (int id = 0; id < 2000; id += 3) {
+        search_server.RemoveDocument(id);
+        reference.RemoveDocument(id);
+    }
+    assert_stale_results("after removing"s);
+
+    search_server.SetMaxIdfStaleness(0.0);
+    for (const std::string& query : queries) {
+        ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments(query),
+            reference.FindTopDocuments(query, DocumentStatus::ACTUAL, 5), query);
+    }
+    for (int id = 2000; id < 2100; ++id) {
+        add_document(id);
+        ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments("rare7"s),
+            reference.FindTopDocuments("rare7"s, DocumentStatus::ACTUAL, 5), std::to_string(id));
+    }
+}
+
+// Sealed segments, the mutable one and removed documents, with filters by
+// status, by rating range only, with both and with an empty range
+void TestDocumentFilterMatchesPredicate() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 9000; ++id) {
+        const std::string text = "cat"s + std::to_string(id % 20) + " dog"s + std::to_string(id % 9);
+        search_server.AddDocument(id, text, static_cast<DocumentStatus>(id % 4), { id % 21 - 10 });
+    }
+    for (int id = 0; id < 9000; id += 7) {
+        search_server.RemoveDocument(id);
+    }
+    const std::vector<DocumentFilter> filters = {
+        { DocumentStatus::BANNED },
+        { std::nullopt, -3, 4 },
+        { DocumentStatus::ACTUAL, 0, std::numeric_limits<int>::max() },
+        { DocumentStatus::REMOVED, std::numeric_limits<int>::min(), -9 },
+        { std::nullopt, 5, 4 },
+        { std::nullopt, 11, 20 },
+    };
+    const std::vector<std::string> queries = { "cat1 dog1"s, "cat2 -dog2"s, "dog8 cat19 cat0"s };
+    for (size_t i = 0; i < filters.size(); ++i) {
+        const DocumentFilter& filter = filters[i];
+        const auto predicate = [filter](int, DocumentStatus status, int rating) {
+            return (!filter.status || status == *filter.status) && rating >= filter.min_rating
+                && rating <= filter.max_rating;
+        };
+        for (const std::string& query : queries) {
+            for (const QueryEvaluation evaluation : { QueryEvaluation::EXHAUSTIVE, QueryEvaluation::WAND }) {
+                const std::string hint = "filter "s + std::to_string(i) + ", "s + query
+                    + (evaluation == QueryEvaluation::WAND ? ", WAND"s : ""s);
+                const std::vector<Document> expected_documents =
+                    search_server.FindTopDocuments(query, predicate, 10, evaluation);
+                ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments(query, filter, 10, evaluation),
+                    expected_documents, hint);
+                ASSERT_SAME_DOCUMENTS(search_server.FindTopDocuments(std::execution::par, query, filter, 10, evaluation),
+                    expected_documents, "par, "s + hint);
+            }
+        }
+    }
+}
+
+// The duplicates are in the sealed segment and in the mutable one. Compact(0)
+// counts the removed documents whose postings are still held
+void TestRemoveDuplicatesCompaction() {
+    for (const bool compact : { false, true }) {
+        SearchServer search_server(""s);
+        for (int id = 0; id < 4100; ++id) {
+            search_server.AddDocument(id, "cat"s + std::to_string(id % 4092) + " dog"s, DocumentStatus::ACTUAL, { 1 });
+        }
+        std::ostringstream report;
+        std::streambuf* const cout_buffer = std::cout.rdbuf(report.rdbuf());
+        RemoveDuplicates(search_server, compact);
+        std::cout.rdbuf(cout_buffer);
+        const std::string lines = report.str();
+        ASSERT_EQUAL(lines.substr(0, 32), "Found duplicate document id 4092"s);
+        ASSERT_EQUAL(std::count(lines.begin(), lines.end(), '\n'), 8);
+        ASSERT_EQUAL(search_server.GetDocumentCount(), 4092);
+        ASSERT_EQUAL(search_server.Compact(0), compact ? 0u : 8u);
+    }
+}
+
+// Writers count shared keys up and insert and erase keys of their own while
+// readers visit both. Every four keys share a hash, so probes pass equal
+// hashes and erasing moves entries back
+void TestConcurrentMapThreads() {
+    struct SharedHash {
+        size_t operator()(int key) const {
+            return static_cast<size_t>(key / 4);
+        }
+    };
+    const int writer_count = 4;
+    const int round_count = 300;
+    const int shared_key_count = 64;
+    const int own_key_count = 2000;
+    ConcurrentMap<int, int, SharedHash> map(2);
+    std::atomic<int> running_writer_count{ writer_count };
+    std::atomic<int> visit_count{ 0 };
+
+    std::vector<std::thread> threads;
+    for (int writer = 0; writer < writer_count; ++writer) {
+        threads.emplace_back([&, writer] {
+            const int first_own_key = shared_key_count + writer * own_key_count;
+            for (int round = 0; round < round_count; ++round) {
+                for (int key = 0; key < shared_key_count; ++key) {
+                    ++map[key].ref_to_value;
+                }
+                for (int key = first_own_key + round; key < first_own_key + own_key_count; key += round_count) {
+                    map[key].ref_to_value = key * 3;
+                }
+                if (round % 2 == 1) {
+                    for (int key = first_own_key + round - 1; key < first_own_key + own_key_count; key += round_count) {
+                        ASSERT(map.Erase(key));
+                    }
+                }
+            }
+            --running_writer_count;
+            });
+    }
+    for (int reader = 0; reader < 2; ++reader) {
+        threads.emplace_back([&] {
+            std::vector<int> last_counts(shared_key_count, 0);
+            do {
+                for (int key = 0; key < shared_key_count; ++key) {
+                    map.Visit(key, [&](int count) {
+                        ASSERT_HINT(count >= last_counts[key] && count <= writer_count * round_count,
+                            std::to_string(key));
+                        last_counts[key] = count;
+                        });
+                }
+                for (int key = shared_key_count; key < shared_key_count + writer_count * own_key_count; key += 7) {
+                    map.Visit(key, [key](int value) {
+                        ASSERT_EQUAL_HINT(value, key * 3, std::to_string(key));
+                        });
+                }
+                ++visit_count;
+                std::this_thread::yield();
+            } while (running_writer_count > 0);
+            });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT(visit_count > 0);
+    const std::map<int, int> result = map.BuildOrdinaryMap();
+    std::map<int, int> expected;
+    for (int key = 0; key < shared_key_count; ++key) {
+        expected[key] = writer_count * round_count;
+    }
+    for (int key = shared_key_count; key < shared_key_count + writer_count * own_key_count; ++key) {
+        if ((key - shared_key_count) % own_key_count % round_count % 2 == 1) {
+            expected[key] = key * 3;
+        }
+    }
+    ASSERT(result == expected);
+}
+
+void TestSearchServer() {
+    RUN_TEST(TestConcurrentMapThreads);
+    RUN_TEST(TestRemoveDuplicatesCompaction);
+    RUN_TEST(TestDocumentFilterMatchesPredicate);
+    RUN_TEST(TestIdfStaleness);
+    RUN_TEST(TestResultCacheBucketEviction);
+    RUN_TEST(TestResultCacheInvalidation);
+    RUN_TEST(TestBatchMatchesSingleQueries);
+    RUN_TEST(TestShardedAddDocumentsRollback);
+    RUN_TEST(TestShardedMatchesUnsharded);
+    RUN_TEST(TestPostingCodecRoundTrip);
+    RUN_TEST(TestSegmentMerges);
+    RUN_TEST(TestConcurrentSnapshotHeldAcrossWrite);
+    RUN_TEST(TestRemoveDocumentTombstones);
+    RUN_TEST(TestSnapshotRoundTrip);
+    RUN_TEST(TestWandMatchesExhaustive);
+    RUN_TEST(TestRejectedDuplicateChangesNothing);
+    RUN_TEST(TestCorpusFileMalformedLine);
+    RUN_TEST(TestTokenizerStopWords);
+    RUN_TEST(TestMatchDocumentsMissingId);
+    RUN_TEST(TestQueryContextAllocations);
+    RUN_TEST(TestConcurrentSearchServerConsistency);
+}
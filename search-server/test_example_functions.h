@@ -1 +1,93 @@
 #pragma once
+
+// Runs all the tests, printing the name of every passed one to std::cerr.
+// A failed check prints where it failed and aborts
+void TestSearchServer();
+
+// Writers add and remove pairs of documents while readers check that every
+// published generation holds whole pairs and does not change while held
+void TestConcurrentSearchServerConsistency();
+
+// Removing documents from sealed segments and from the mutable one, adding
+// their ids again and compacting keep the results of a plain reference index
+void TestRemoveDocumentTombstones();
+
+// Results stay those of a plain reference index while documents cross the
+// sealing and merging thresholds one by one and in a batch, and merges drop
+// the postings of removed documents
+void TestSegmentMerges();
+
+// A snapshot loads into an index with the same results, also when it is
+// saved over the file a loaded server still reads, and a truncated or
+// corrupted file is rejected
+void TestSnapshotRoundTrip();
+
+// ConcurrentMap keeps every increment and every insert and erase made from
+// several threads, and readers meanwhile see only whole values
+void TestConcurrentMapThreads();
+
+// RemoveDuplicates leaves the postings of the removed documents in place
+// unless it is asked to compact the index
+void TestRemoveDuplicatesCompaction();
+
+// A DocumentFilter, applied as bitmaps and rating columns, returns the
+// documents of the predicate lambda checking the same conditions
+void TestDocumentFilterMatchesPredicate();
+
+// A positive IDF staleness keeps scores within its bound of the exact ones
+// while documents are added and removed, and setting it back to 0 makes them
+// exact at once
+void TestIdfStaleness();
+
+// Adding or removing a document makes the next query miss the result cache
+// and return the changed results
+void TestResultCacheInvalidation();
+
+// ResultCache evicts the least recently used key of a full bucket and keeps
+// the keys of the other buckets
+void TestResultCacheBucketEviction();
+
+// FindTopDocumentsBatch, sequential and parallel, returns the documents of
+// FindTopDocuments for every query, around the ends of its id windows too
+void TestBatchMatchesSingleQueries();
+
+// A ShardedSearchServer returns the documents of a single SearchServer with
+// the same documents, rejects an invalid query before the shards run and
+// rethrows an exception thrown in a shard
+void TestShardedMatchesUnsharded();
+
+// A batch ShardedSearchServer::AddDocuments fails on leaves no document of it
+// in any shard
+void TestShardedAddDocumentsRollback();
+
+// Packed posting lists decode to the ids and frequency codes they were packed
+// from, block by block and through cursors, for lists of full blocks, partial
+// tails and both
+void TestPostingCodecRoundTrip();
+
+// Block-max WAND returns the same documents as exhaustive scoring for random
+// queries over an index full of relevance and rating ties
+void TestWandMatchesExhaustive();
+
+// With DuplicatePolicy::REJECT a rejected document leaves the dictionary and
+// the result cache as they were
+void TestRejectedDuplicateChangesNothing();
+
+// A malformed corpus line is reported with its number, and failing again on
+// it reports the same number
+void TestCorpusFileMalformedLine();
+
+// Tokenizer drops stop words and never takes the empty word for one
+void TestTokenizerStopWords();
+
+// MatchDocuments(par) throws std::out_of_range for an id which is not in the
+// index
+void TestMatchDocumentsMissingId();
+
+// A snapshot held across Publish() stops the next write until it is released,
+// and makes that write throw instead if it is held longer than the wait limit
+void TestConcurrentSnapshotHeldAcrossWrite();
+
+// Queries through a grown SearchServer::QueryContext make no heap
+// allocations, with the result cache off and with it serving hits
+void TestQueryContextAllocations();
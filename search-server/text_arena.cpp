@@ -0,0 +1,31 @@
+#include "text_arena.h"
+
+#include <algorithm>
+
+std::string_view TextArena::Store(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    if (text.size() > chunk_free_) {
+        // Long strings get their own chunk so they don't waste the rest of the current one
+        if (text.size() > chunk_size_ / 4) {
+            auto chunk = std::make_unique<char[]>(text.size());
+            std::copy(text.begin(), text.end(), chunk.get());
+            const std::string_view stored(chunk.get(), text.size());
+            allocated_bytes_ += text.size();
+            chunks_.insert(chunks_.empty() ? chunks_.end() : chunks_.end() - 1, std::move(chunk));
+            return stored;
+        }
+        chunks_.push_back(std::make_unique<char[]>(chunk_size_));
+        chunk_free_ = chunk_size_;
+        allocated_bytes_ += chunk_size_;
+    }
+    char* data = chunks_.back().get() + (chunk_size_ - chunk_free_);
+    std::copy(text.begin(), text.end(), data);
+    chunk_free_ -= text.size();
+    return { data, text.size() };
+}
+
+size_t TextArena::GetMemoryUsage() const {
+    return allocated_bytes_ + chunks_.capacity() * sizeof(std::unique_ptr<char[]>);
+}
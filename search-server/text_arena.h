@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only string storage: text is copied into large chunks which never
+// move, so views into the arena stay valid for its whole lifetime
+class TextArena {
+public:
+    std::string_view Store(std::string_view text);
+
+    size_t GetMemoryUsage() const;
+
+private:
+    const static size_t chunk_size_ = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t chunk_free_ = 0;
+    size_t allocated_bytes_ = 0;
+};
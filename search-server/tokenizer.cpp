@@ -0,0 +1,133 @@
+#include "tokenizer.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TOKENIZER_SSE2
+#endif
+
+namespace {
+
+bool IsControlCharacter(char c) {
+    return c >= '\0' && c < ' ';
+}
+
+// The word of text around position
+std::string_view GetWordAt(std::string_view text, size_t position) {
+    const size_t first = text.rfind(' ', position) + 1;     // 0 if there is no space before
+    const size_t last = std::min(text.find(' ', position), text.size());
+    return text.substr(first, last - first);
+}
+
+#ifdef TOKENIZER_SSE2
+size_t CountTrailingZeros(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(value);
+#else
+    size_t bit = 0;
+    while ((value >> bit & 1) == 0) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+#endif
+
+} // namespace
+
+Tokenizer::Tokenizer(std::vector<std::string> stop_words)
+    : stop_words_(std::move(stop_words))
+{
+    std::sort(stop_words_.begin(), stop_words_.end());
+    for (const std::string& stop_word : stop_words_) {
+        for (size_t bit : GetBloomBits(stop_word)) {
+            bloom_bits_[bit / 64] |= uint64_t{ 1 } << bit % 64;
+        }
+    }
+}
+
+// Every 16 bytes give a mask of spaces; the bits where it differs from the
+// mask shifted by one byte are the starts and ends of words, so the loop
+// touches each word twice however long it is
+std::optional<std::string_view> Tokenizer::SplitIntoWordsNoStop(std::string_view text,
+    std::vector<std::string_view>& words) const {
+    words.clear();
+    const char* data = text.data();
+    size_t position = 0;
+    size_t word_start = 0;
+    uint32_t previous_space = 1;        // the text is as if preceded by a space
+
+#ifdef TOKENIZER_SSE2
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+    for (; position + 16 <= text.size(); position += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+        // Unsigned max leaves 31 only in bytes 0-31
+        const int controls = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, last_control), last_control));
+        if (controls != 0) {
+            return GetWordAt(text, position + CountTrailingZeros(static_cast<uint32_t>(controls)));
+        }
+        const uint32_t space_bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces)));
+        uint32_t boundaries = (space_bits ^ (space_bits << 1 | previous_space)) & 0xFFFF;
+        previous_space = space_bits >> 15;
+        while (boundaries != 0) {
+            const size_t bit = CountTrailingZeros(boundaries);
+            if (space_bits >> bit & 1) {
+                AddWord(text.substr(word_start, position + bit - word_start), words);
+            }
+            else {
+                word_start = position + bit;
+            }
+            boundaries &= boundaries - 1;
+        }
+    }
+#endif
+
+    for (; position < text.size(); ++position) {
+        const char c = data[position];
+        if (IsControlCharacter(c)) {
+            return GetWordAt(text, position);
+        }
+        const uint32_t is_space = c == ' ';
+        if (is_space != previous_space) {
+            if (is_space) {
+                AddWord(text.substr(word_start, position - word_start), words);
+            }
+            else {
+                word_start = position;
+            }
+        }
+        previous_space = is_space;
+    }
+    if (!previous_space) {
+        AddWord(text.substr(word_start), words);
+    }
+    return std::nullopt;
+}
+
+bool Tokenizer::IsStopWord(std::string_view word) const {
+    // Stop words are never empty, and GetBloomBits needs a character
+    if (word.empty()) {
+        return false;
+    }
+    for (size_t bit : GetBloomBits(word)) {
+        if ((bloom_bits_[bit / 64] >> bit % 64 & 1) == 0) {
+            return false;
+        }
+    }
+    return std::binary_search(stop_words_.begin(), stop_words_.end(), word, std::less<>());
+}
+
+// Length and the outer characters tell most words apart without hashing them whole
+std::array<size_t, 2> Tokenizer::GetBloomBits(std::string_view word) {
+    const uint32_t hash = ((static_cast<uint8_t>(word.front()) * 31u + static_cast<uint8_t>(word.back())) * 31u
+        + static_cast<uint32_t>(word.size())) * 0x9E3779B1u;
+    return { hash % bloom_bit_count_, (hash >> 24) % bloom_bit_count_ };
+}
+
+void Tokenizer::AddWord(std::string_view word, std::vector<std::string_view>& words) const {
+    if (!IsStopWord(word)) {
+        words.push_back(word);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Splits document text into words in one pass: spaces and control characters
+// (codes 0-31) are found 16 bytes at a time with SSE2, and stop words are
+// dropped on the way. A small bloom filter answers for most words that they
+// are not stop words without comparing any text
+class Tokenizer {
+public:
+    Tokenizer() = default;
+
+    // Stop words must be distinct, non-empty and valid
+    explicit Tokenizer(std::vector<std::string> stop_words);
+
+    // Fills words with the words of text which are not stop words, splitting
+    // on spaces like SplitIntoWords and reusing the memory of words. Returns
+    // the first word with a control character, or std::nullopt if there is none;
+    // words are left incomplete then
+    std::optional<std::string_view> SplitIntoWordsNoStop(std::string_view text,
+        std::vector<std::string_view>& words) const;
+
+    bool IsStopWord(std::string_view word) const;
+
+private:
+    const static size_t bloom_bit_count_ = 256;
+
+    std::vector<std::string> stop_words_;       // sorted
+    std::array<uint64_t, bloom_bit_count_ / 64> bloom_bits_ = {};
+
+    static std::array<size_t, 2> GetBloomBits(std::string_view word);
+
+    void AddWord(std::string_view word, std::vector<std::string_view>& words) const;
+};
@@ -0,0 +1,63 @@
+#include "top_documents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPSILON) {
+        if (lhs.rating == rhs.rating) {
+            return lhs.id < rhs.id;
+        }
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+TopDocumentsCollector::TopDocumentsCollector(size_t max_count)
+    : max_count_(max_count)
+{
+    heap_.reserve(max_count_);
+}
+
+void TopDocumentsCollector::Reset(size_t max_count) {
+    max_count_ = max_count;
+    heap_.clear();
+    heap_.reserve(max_count_);
+}
+
+// The heap top is the least relevant of the collected documents
+void TopDocumentsCollector::Add(const Document& document) {
+    if (heap_.size() < max_count_) {
+        heap_.push_back(document);
+        std::push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    }
+    else if (max_count_ > 0 && IsMoreRelevant(document, heap_.front())) {
+        std::pop_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        heap_.back() = document;
+        std::push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    }
+}
+
+double TopDocumentsCollector::GetMinRelevance() const {
+    if (max_count_ == 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    if (heap_.size() < max_count_) {
+        return -std::numeric_limits<double>::infinity();
+    }
+    return heap_.front().relevance - RELEVANCE_EPSILON;
+}
+
+std::vector<Document> TopDocumentsCollector::Extract() {
+    std::sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    std::vector<Document> result;
+    result.swap(heap_);
+    return result;
+}
+
+void TopDocumentsCollector::Extract(std::vector<Document>& documents) {
+    std::sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    documents.assign(heap_.begin(), heap_.end());
+    heap_.clear();
+}
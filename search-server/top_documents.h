@@ -0,0 +1,36 @@
+#pragma once
+
+#include "document.h"
+
+#include <cstddef>
+#include <vector>
+
+// Documents with relevance closer than this are ordered by rating, then by id
+const double RELEVANCE_EPSILON = 1e-6;
+
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+// Keeps the max_count most relevant documents seen so far in a bounded heap,
+// so a query never has to sort all of its matches
+class TopDocumentsCollector {
+public:
+    explicit TopDocumentsCollector(size_t max_count);
+
+    // Drops the collected documents keeping the memory for the next ones
+    void Reset(size_t max_count);
+
+    void Add(const Document& document);
+
+    // Relevance below which a document cannot get into the collector anymore
+    double GetMinRelevance() const;
+
+    // Returns collected documents from the most relevant one and leaves the collector empty
+    std::vector<Document> Extract();
+
+    // Copies the documents into the memory of documents instead
+    void Extract(std::vector<Document>& documents);
+
+private:
+    size_t max_count_;
+    std::vector<Document> heap_;
+};